@@ -0,0 +1,436 @@
+#include "nano-osc.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Usage: nanoosc_bench [--filter <substring>] [--min-time <ms>] [--port <udp port>] [--capture <file>]
+//
+// Every benchmark reports ns/op and allocations/op; the UDP ones also report packets/s and
+// one-way latency percentiles through the real OSCClient -> OSCServer path over loopback.
+// With --capture, the packets of a CaptureWriter recording are also dispatched round robin.
+
+using namespace NanoOsc;
+using Clock = std::chrono::steady_clock;
+
+// Every allocation in the process goes through these, so allocs/op is exact
+static std::atomic<uint64_t> g_allocations {0};
+
+void* operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+
+struct Options
+{
+    std::string filter;
+    std::chrono::milliseconds min_time {200};
+    uint16_t port {9300};
+    std::string capture;
+};
+
+Options g_options;
+
+// How long the UDP benchmarks wait for an outstanding datagram before counting it as lost
+const auto LOSS_TIMEOUT = std::chrono::milliseconds(5);
+
+// Keeps the optimiser from discarding a benchmark's result
+template <typename T>
+void keep(const T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+bool selected(const std::string& name)
+{
+    return g_options.filter.empty() || name.find(g_options.filter) != std::string::npos;
+}
+
+// Runs `op` in growing batches until min_time has elapsed, then prints ns/op and allocs/op
+void bench(const std::string& name, const std::function<void()>& op)
+{
+    if (!selected(name)) return;
+    for (int i = 0; i < 1000; ++i) op();
+
+    uint64_t iterations = 0;
+    uint64_t batch      = 64;
+    auto start          = Clock::now();
+    uint64_t allocs     = g_allocations.load(std::memory_order_relaxed);
+    Clock::duration elapsed {};
+    while (elapsed < g_options.min_time)
+    {
+        for (uint64_t i = 0; i < batch; ++i) op();
+        iterations += batch;
+        batch      *= 2;
+        elapsed     = Clock::now() - start;
+    }
+    allocs = g_allocations.load(std::memory_order_relaxed) - allocs;
+
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+    std::printf(
+        "%-44s %10.1f ns/op %8.2f allocs/op %14.0f ops/s\n", name.c_str(), ns / iterations,
+        static_cast<double>(allocs) / iterations, iterations / (ns * 1e-9)
+    );
+}
+
+Message small_message()
+{
+    Message msg("/synth/1/freq");
+    msg.add_float(440.0f);
+    return msg;
+}
+
+Message mixed_message()
+{
+    Message msg("/mixer/channel/12/eq/band/3");
+    msg.add_int32(42);
+    msg.add_float(-0.5f);
+    msg.add_string("parametric");
+    std::vector<uint8_t> blob(32, 0xAB);
+    msg.add_blob(blob.data(), blob.size());
+    return msg;
+}
+
+Message float_message(size_t count)
+{
+    Message msg("/spectrum");
+    for (size_t i = 0; i < count; ++i) msg.add_float(static_cast<float>(i));
+    return msg;
+}
+
+// `width` messages per level, `depth` levels of nesting
+Bundle nested_bundle(size_t depth, size_t width)
+{
+    Bundle bundle;
+    bundle.timetag = TIMETAG_IMMEDIATE;
+    for (size_t i = 0; i < width; ++i) bundle.add_message(mixed_message());
+    if (depth > 1) bundle.add_bundle(nested_bundle(depth - 1, width));
+    return bundle;
+}
+
+void bench_encode()
+{
+    struct Case
+    {
+        const char* name;
+        Message msg;
+    };
+    std::vector<Case> cases = {
+        {"small", small_message()}, {"mixed", mixed_message()}, {"floats64", float_message(64)}
+    };
+    std::vector<uint8_t> buffer(BUFFER_MAX_SIZE);
+    for (const auto& c : cases)
+    {
+        const Message& msg = c.msg;
+        bench(std::string("message/encode/") + c.name, [&] { keep(msg.encode()); });
+        bench(
+            std::string("message/encode_into/") + c.name, [&] { keep(msg.encode_into(buffer.data(), buffer.size())); }
+        );
+        CompactMessage compact(msg);
+        bench(
+            std::string("compact/encode_into/") + c.name,
+            [&] { keep(compact.encode_into(buffer.data(), buffer.size())); }
+        );
+
+        auto encoded = msg.encode();
+        bench(std::string("message/decode/") + c.name, [&] { keep(Message::decode(encoded.data(), encoded.size())); });
+        Message target {std::string {}};
+        bench(
+            std::string("message/decode_into/") + c.name,
+            [&] { Message::decode_into(target, encoded.data(), encoded.size()); }
+        );
+        bench(
+            std::string("view/decode/") + c.name, [&] { keep(MessageView::decode(encoded.data(), encoded.size())); }
+        );
+    }
+
+    for (size_t depth : {1, 4})
+    {
+        Bundle bundle   = nested_bundle(depth, 4);
+        auto encoded    = bundle.encode();
+        std::string tag = "depth" + std::to_string(depth);
+        bench("bundle/encode/" + tag, [&] { keep(bundle.encode()); });
+        bench("bundle/encode_into/" + tag, [&] { keep(bundle.encode_into(buffer.data(), buffer.size())); });
+        bench("bundle/decode/" + tag, [&] { keep(Bundle::decode(encoded.data(), encoded.size())); });
+        Bundle target;
+        bench("bundle/decode_into/" + tag, [&] { Bundle::decode_into(target, encoded.data(), encoded.size()); });
+        bench("bundle_view/decode/" + tag, [&] { keep(BundleView::decode(encoded.data(), encoded.size())); });
+    }
+
+    // Picking one message out of 64 by address: deep validation up front versus lazy traversal
+    Bundle wide;
+    for (int i = 0; i < 64; ++i) wide.add_message(mixed_message());
+    Message wanted("/wanted");
+    wanted.add_float(1.0f);
+    wide.add_message(wanted);
+    auto encoded_wide = wide.encode();
+    auto pick         = [](const BundleView& view)
+    {
+        for (const auto& element : view)
+        {
+            MessageView msg;
+            if (element.address() == "/wanted" && element.try_message(msg) == PacketError::None) keep(msg);
+        }
+    };
+    bench("bundle_view/filter/deep", [&] { pick(BundleView::decode(encoded_wide.data(), encoded_wide.size())); });
+    bench("bundle_view/filter/lazy", [&] { pick(BundleView::decode_lazy(encoded_wide.data(), encoded_wide.size())); });
+}
+
+void bench_dispatch()
+{
+    auto encoded       = mixed_message().encode();
+    auto small         = small_message().encode();
+    uint64_t delivered = 0;
+
+    OSCServer owning(std::make_unique<UDPTransport>(g_options.port));
+    owning.set_message_handler([&](const Message&) { delivered++; });
+    bench("dispatch/message_handler", [&] { owning.process_packet(encoded.data(), encoded.size()); });
+
+    OSCServer viewing(std::make_unique<UDPTransport>(g_options.port + 1));
+    viewing.set_message_view_handler([&](const MessageView&) { delivered++; });
+    bench("dispatch/view_handler", [&] { viewing.process_packet(encoded.data(), encoded.size()); });
+
+    AddressSpace space;
+    for (int i = 0; i < 64; ++i)
+    {
+        space.add_method("/synth/" + std::to_string(i) + "/freq", [&](const MessageView&) { delivered++; });
+    }
+    OSCServer routed(std::make_unique<UDPTransport>(g_options.port + 2));
+    routed.set_address_space(&space);
+    bench("dispatch/address_space/literal", [&] { routed.process_packet(small.data(), small.size()); });
+
+    Message pattern("/synth/*/freq");
+    pattern.add_float(1.0f);
+    auto wildcard = pattern.encode();
+    bench("dispatch/address_space/pattern", [&] { routed.process_packet(wildcard.data(), wildcard.size()); });
+    keep(delivered);
+}
+
+// Dispatches a recorded capture's packets round robin, so decode and routing see real traffic
+void bench_capture()
+{
+    if (g_options.capture.empty()) return;
+    CaptureReader reader(g_options.capture);
+    std::vector<CaptureRecord> records;
+    CaptureRecord record;
+    while (reader.next(record)) records.push_back(record);
+    if (records.empty()) return;
+
+    uint64_t delivered = 0;
+    size_t next        = 0;
+    auto packet        = [&]() -> const CaptureRecord&
+    {
+        const CaptureRecord& r = records[next];
+        next                   = next + 1 == records.size() ? 0 : next + 1;
+        return r;
+    };
+
+    OSCServer owning(std::make_unique<UDPTransport>(g_options.port));
+    owning.set_message_handler([&](const Message&) { delivered++; });
+    owning.set_bundle_handler([&](const Bundle&) { delivered++; });
+    bench(
+        "capture/dispatch/owning",
+        [&]
+        {
+            const CaptureRecord& r = packet();
+            owning.process_packet(r.data, r.size, r.info);
+        }
+    );
+
+    OSCServer viewing(std::make_unique<UDPTransport>(g_options.port + 1));
+    viewing.set_message_view_handler([&](const MessageView&) { delivered++; });
+    viewing.set_bundle_view_handler([&](const BundleView&) { delivered++; });
+    bench(
+        "capture/dispatch/view",
+        [&]
+        {
+            const CaptureRecord& r = packet();
+            viewing.process_packet(r.data, r.size, r.info);
+        }
+    );
+    keep(delivered);
+}
+
+// One-way latency and throughput over loopback. The sender stamps each message with its send
+// time on the shared steady clock and the server's handler records the difference. At most
+// `in_flight` packets are outstanding, so a small window measures latency rather than queueing.
+void bench_udp(const std::string& name, size_t burst, size_t in_flight, bool io_uring = false)
+{
+    if (!selected(name)) return;
+    const uint16_t port = g_options.port + 3;
+    std::unique_ptr<Transport> transport;
+    if (io_uring)
+    {
+        transport = std::make_unique<IoUringUDPTransport>(port);
+    }
+    else
+    {
+        transport = std::make_unique<UDPTransport>(port);
+    }
+    OSCServer server(std::move(transport));
+    OSCClient client(std::make_unique<UDPTransport>("127.0.0.1", port));
+    if (burst > 1) client.enable_queue(burst);
+
+    std::vector<uint32_t> latencies;
+    latencies.reserve(1 << 20);
+    std::atomic<uint64_t> received {0};
+    server.set_message_view_handler(
+        [&](const MessageView& msg)
+        {
+            int64_t sent = msg[0].as_int64();
+            int64_t now  = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+            if (latencies.size() < latencies.capacity()) latencies.push_back(static_cast<uint32_t>(now - sent));
+            received.fetch_add(1, std::memory_order_relaxed);
+        }
+    );
+
+    std::atomic<bool> running {true};
+    std::thread receiver(
+        [&]
+        {
+            while (running.load(std::memory_order_relaxed)) server.wait_and_process(std::chrono::milliseconds(10));
+        }
+    );
+
+    Message msg("/bench/latency");
+    msg.add_int64(0);
+    msg.add_float(0.0f);
+
+    uint64_t sent        = 0;
+    uint64_t written_off = 0;
+    uint64_t sent_before = client.stats().snapshot().packets_sent;
+    uint64_t allocs      = g_allocations.load(std::memory_order_relaxed);
+    auto start           = Clock::now();
+    while (Clock::now() - start < g_options.min_time * 5)
+    {
+        size_t accepted = 0;
+        for (size_t i = 0; i < burst; ++i)
+        {
+            msg.arguments[0] = OSCInt64 {
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count()
+            };
+            if (client.send_message(msg)) ++accepted;
+        }
+        bool flushed = burst == 1 || client.flush();
+        // Only packets that actually left count as sent; on a failure the client's own counter says how many did
+        if (accepted == burst && flushed)
+        {
+            sent += burst;
+        }
+        else
+        {
+            sent = client.stats().snapshot().packets_sent - sent_before;
+        }
+        // Let the receiver keep up so the socket buffer doesn't overflow and skew the numbers. A
+        // datagram that hasn't arrived by the deadline is written off as lost rather than waited on.
+        auto deadline = Clock::now() + LOSS_TIMEOUT;
+        for (;;)
+        {
+            int64_t outstanding = static_cast<int64_t>(sent - written_off) -
+                                  static_cast<int64_t>(received.load(std::memory_order_relaxed));
+            if (outstanding < static_cast<int64_t>(in_flight)) break;
+            if (Clock::now() >= deadline)
+            {
+                written_off += static_cast<uint64_t>(outstanding) - in_flight + 1;
+                break;
+            }
+            std::this_thread::yield();
+        }
+    }
+    auto elapsed = Clock::now() - start;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    allocs = g_allocations.load(std::memory_order_relaxed) - allocs;
+    running.store(false, std::memory_order_relaxed);
+    receiver.join();
+
+    double secs   = std::chrono::duration<double>(elapsed).count();
+    uint64_t got  = received.load();
+    uint64_t lost = sent > got ? sent - got : 0;
+    double ops    = static_cast<double>(std::max<uint64_t>(sent, 1));
+    std::sort(latencies.begin(), latencies.end());
+    auto pct = [&](double q)
+    {
+        return latencies.empty() ? 0.0 : latencies[static_cast<size_t>(q * (latencies.size() - 1))] * 1e-3;
+    };
+    std::printf(
+        "%-44s %10.1f ns/op %8.2f allocs/op %14.0f pkts/s  lost %llu  p50 %.1fus p99 %.1fus p99.9 %.1fus\n",
+        name.c_str(), secs * 1e9 / ops, static_cast<double>(allocs) / ops, got / secs, static_cast<unsigned long long>(lost), pct(0.5), pct(0.99), pct(0.999)
+    );
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc)
+        {
+            g_options.filter = argv[++i];
+        }
+        else if (arg == "--min-time" && i + 1 < argc)
+        {
+            g_options.min_time = std::chrono::milliseconds(std::atoi(argv[++i]));
+        }
+        else if (arg == "--port" && i + 1 < argc)
+        {
+            g_options.port = static_cast<uint16_t>(std::atoi(argv[++i]));
+        }
+        else if (arg == "--capture" && i + 1 < argc)
+        {
+            g_options.capture = argv[++i];
+        }
+        else
+        {
+            std::fprintf(
+                stderr,
+                "usage: %s [--filter <substring>] [--min-time <ms>] [--port <udp port>] [--capture <file>]\n",
+                argv[0]
+            );
+            return 1;
+        }
+    }
+
+    bench_encode();
+    bench_dispatch();
+    bench_capture();
+    bench_udp("udp/latency/single", 1, 1);
+    bench_udp("udp/throughput/single", 1, 256);
+    bench_udp("udp/throughput/batched32", 32, 256);
+    bench_udp("io_uring/latency/single", 1, 1, true);
+    bench_udp("io_uring/throughput/batched32", 32, 256, true);
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "nano-osc.hpp"
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#if !NANOOSC_COROUTINES
+#error "osc-async needs a C++20 compiler with coroutine support"
+#endif
+
+using namespace std::chrono_literals;
+
+const int PING_PORT     = 9000;
+const int PONG_PORT     = 9001;
+const int PING_COUNT    = 100;
+const int REPLY_TIMEOUT = 1000;
+
+// Answers every /ping <n> with /pong/<n> <2n> until /quit arrives
+NanoOsc::Task<> responder(NanoOsc::AsyncServer& pings, NanoOsc::AsyncClient& replies)
+{
+    for (;;)
+    {
+        NanoOsc::Message msg = co_await pings.next_message();
+        if (msg.address == "/quit") break;
+        if (msg.address != "/ping" || msg.tags != ",i") continue;
+
+        int32_t n = std::get<NanoOsc::OSCInt>(msg.arguments[0]);
+        NanoOsc::Message pong("/pong/" + std::to_string(n));
+        pong.add_int32(n * 2);
+        bool sent = co_await replies.async_send(pong);
+        if (!sent) std::cout << "reply " << n << " could not be sent\n";
+    }
+}
+
+// One conversation: sends /ping <n> and waits for its own /pong/<n>
+NanoOsc::Task<bool> ping(NanoOsc::AsyncServer& pongs, NanoOsc::OSCClient& to_responder, int32_t n)
+{
+    NanoOsc::Message msg("/ping");
+    msg.add_int32(n);
+    auto reply = co_await pongs.request(
+        to_responder, msg, "/pong/" + std::to_string(n), std::chrono::milliseconds(REPLY_TIMEOUT)
+    );
+    co_return reply && std::get<NanoOsc::OSCInt>(reply->arguments[0]) == n * 2;
+}
+
+struct Tally
+{
+    int answered {0};
+    int finished {0};
+};
+
+NanoOsc::Task<> count_ping(NanoOsc::AsyncServer& pongs, NanoOsc::OSCClient& to_responder, int32_t n, Tally& tally)
+{
+    bool answered = co_await ping(pongs, to_responder, n);
+    if (answered) ++tally.answered;
+    ++tally.finished;
+}
+
+NanoOsc::Task<int> ping_all(NanoOsc::EventLoop& loop, NanoOsc::AsyncServer& pongs, NanoOsc::OSCClient& to_responder)
+{
+    // All conversations run at once on the loop's thread; each one only sees its own reply
+    Tally tally;
+    for (int32_t n = 0; n < PING_COUNT; ++n) NanoOsc::spawn(loop, count_ping(pongs, to_responder, n, tally));
+    while (tally.finished < PING_COUNT) co_await NanoOsc::sleep_for(loop, 1ms);
+    co_return tally.answered;
+}
+
+int main(int argc, char* argv[])
+{
+    std::cout << "Creating EventLoop..." << std::endl;
+
+    NanoOsc::EventLoop loop;
+    NanoOsc::OSCServer ping_server(std::make_unique<NanoOsc::UDPTransport>(PING_PORT));
+    NanoOsc::OSCServer pong_server(std::make_unique<NanoOsc::UDPTransport>(PONG_PORT));
+    NanoOsc::OSCClient to_responder(std::make_unique<NanoOsc::UDPTransport>("127.0.0.1", PING_PORT));
+    NanoOsc::OSCClient to_requester(std::make_unique<NanoOsc::UDPTransport>("127.0.0.1", PONG_PORT));
+
+    NanoOsc::AsyncServer pings(loop, ping_server);
+    NanoOsc::AsyncServer pongs(loop, pong_server);
+    NanoOsc::AsyncClient replies(loop, to_requester);
+
+    NanoOsc::spawn(loop, responder(pings, replies));
+    int answered = NanoOsc::run_until_complete(loop, ping_all(loop, pongs, to_responder));
+    std::cout << answered << "/" << PING_COUNT << " pings answered\n";
+
+    to_responder.send_message(NanoOsc::Message("/quit"));
+    loop.run_once(100ms);
+
+    return answered == PING_COUNT ? 0 : 1;
+}
@@ -66,8 +66,7 @@ int main(int argc, char* argv[])
 
     for (;;)
     {
-        auto received = server.process_all();
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        auto received = server.wait_and_process();
     }
 
     return 0;
@@ -1,17 +1,77 @@
 #ifndef NANO_OSC_HPP
 #define NANO_OSC_HPP
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstring>
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <cstdint>
+#include <deque>
+#include <optional>
 #include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
 #include <vector>
 
+// Set NANOOSC_STATS to 0 to compile the Stats counters and handler timing out of the hot paths
+#ifndef NANOOSC_STATS
+#define NANOOSC_STATS 1
+#endif
+
+// The coroutine API (Task, AsyncServer, AsyncClient) is available when compiling as C++20
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#include <list>
+#define NANOOSC_COROUTINES 1
+#else
+#define NANOOSC_COROUTINES 0
+#endif
+
 namespace NanoOsc {
 
 const int BUFFER_MAX_SIZE               = 65536;
+const int RECEIVE_BATCH_SIZE            = 16;
+const int SEND_QUEUE_MAX_PACKETS        = 64;
+const int SCHEDULER_MAX_PENDING         = 1024;
+const int RECEIVE_QUEUE_CAPACITY        = 1024;
+const int RECEIVE_QUEUE_SLOT_SIZE       = 2048;
+const int CACHE_LINE_SIZE               = 64;
+const int ERROR_REPORTS_PER_SECOND      = 10;
+const int TIMING_MAX_SOURCES            = 256;
+const int TCP_MAX_FRAME_SIZE            = 64 * 1024 * 1024;
+const int TCP_SEND_TIMEOUT_MS           = 5000;
+// Bytes a TCP server queues for a peer that isn't keeping up before disconnecting it
+const int TCP_SEND_QUEUE_LIMIT          = 8 * 1024 * 1024;
+const int SHARED_MEMORY_CAPACITY        = 1024;
+const int SHARED_MEMORY_SLOT_SIZE       = 8192;
+const int IO_URING_BUFFER_COUNT         = 1024;
+const int IO_URING_BUFFER_SIZE          = 4096;
+const int FANOUT_FAILURE_LIMIT          = 8;
+const int FANOUT_RETRY_MS               = 1000;
+// Largest UDP payload that fits a 1500-byte Ethernet frame without fragmenting
+const int COALESCE_MTU                  = 1472;
+const int COALESCE_MAX_DELAY_US         = 1000;
+const int VALUE_COALESCE_CAPACITY       = 256;
+const int CAPTURE_BUFFER_SIZE           = 64 * 1024;
+// Deepest bundle nesting the decoders accept; each level is only 20 bytes on the wire
+const int BUNDLE_MAX_DEPTH              = 64;
+const int ASYNC_QUEUE_CAPACITY          = 1024;
+const int ASYNC_SEND_TIMEOUT_MS         = 1000;
+// How often servers whose transport has no pollable descriptor check it for packets
+const int POLL_INTERVAL_MS              = 1;
 constexpr std::array<char, 8> BUNDLE_ID = {'#', 'b', 'u', 'n', 'd', 'l', 'e', 0};
 
 using OSCInt     = int32_t;
@@ -23,253 +83,145 @@ using OSCString  = std::string;
 using OSCBlob    = std::vector<uint8_t>;
 using OSCValue   = std::variant<OSCInt, OSCInt64, OSCFloat, OSCFloat64, OSCString, OSCBlob, OSCTimeTag>;
 
-class Message
-{
-public:
-    std::string address;
-    std::string tags;
-    std::vector<OSCValue> arguments;
-
-    explicit Message(const std::string& addr) : address(addr)
-    {
-        tags.push_back(',');
-    }
-
-    void clear()
-    {
-        tags.assign(1, ',');
-        arguments.clear();
-    }
-    void add_int32(int32_t value)
-    {
-        tags.push_back('i');
-        arguments.emplace_back(value);
-    }
-    void add_float(float value)
-    {
-        tags.push_back('f');
-        arguments.emplace_back(value);
-    }
-    void add_string(const std::string& value)
-    {
-        tags.push_back('s');
-        arguments.emplace_back(value);
-    }
-    void add_blob(const uint8_t* data, size_t size)
-    {
-        tags.push_back('b');
-        arguments.emplace_back(OSCBlob(data, data + size));
-    }
-
-    std::vector<uint8_t> encode() const;
-    static Message decode(const uint8_t* data, size_t size);
-};
+// The special timetag meaning "execute immediately"
+constexpr OSCTimeTag TIMETAG_IMMEDIATE = 1;
+// Seconds between the NTP epoch (1900) and the Unix epoch (1970)
+constexpr uint64_t NTP_UNIX_OFFSET = 2208988800ULL;
 
-class Bundle
+inline OSCTimeTag to_timetag(std::chrono::system_clock::time_point tp)
 {
-public:
-    std::vector<Message> messages;
-    std::vector<Bundle> bundles;
-    OSCTimeTag timetag {1};
-
-    Bundle() = default;
-
-    void clear()
-    {
-        messages.clear();
-        bundles.clear();
-        timetag = 1;
-    }
-
-    void add_message(const Message& msg)
-    {
-        messages.emplace_back(msg);
-    }
-
-    void add_bundle(const Bundle& bundle)
-    {
-        bundles.emplace_back(bundle);
-    }
-
-
-    std::vector<uint8_t> encode() const;
-    static Bundle decode(const uint8_t* data, size_t size);
-};
+    auto ns       = std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+    uint64_t secs = static_cast<uint64_t>(ns / 1000000000) + NTP_UNIX_OFFSET;
+    uint64_t frac = (static_cast<uint64_t>(ns % 1000000000) << 32) / 1000000000;
+    return (secs << 32) | frac;
+}
 
-class Transport
+inline std::chrono::system_clock::time_point from_timetag(OSCTimeTag tt)
 {
-public:
-    Transport()                            = default;
-    Transport(const Transport&)            = delete;
-    Transport(Transport&&)                 = delete;
-    Transport& operator=(const Transport&) = delete;
-    Transport& operator=(Transport&&)      = delete;
-    virtual ~Transport()                   = default;
-
-    virtual bool send(const uint8_t* data, size_t size)         = 0;
-    virtual size_t receive(uint8_t* buffer, size_t buffer_size) = 0;
-    virtual bool is_ready() const                               = 0;
-    virtual void close()                                        = 0;
-};
+    auto secs = static_cast<int64_t>(tt >> 32) - static_cast<int64_t>(NTP_UNIX_OFFSET);
+    auto ns   = static_cast<int64_t>(((tt & 0xFFFFFFFFULL) * 1000000000) >> 32);
+    return std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(secs * 1000000000 + ns))
+    );
+}
 
-class UDPTransport final : public Transport
+inline OSCTimeTag timetag_now()
 {
-public:
-    UDPTransport(const std::string& host, uint16_t port)
-        : m_socket_fd(-1), m_host(host), m_port(port), m_is_server(false), m_connected(false)
-    {
-        if (!setup_client())
-        {
-            throw std::system_error(errno, std::generic_category(), "UDP client setup failed");
-        }
-    }
-    explicit UDPTransport(uint16_t port) : m_socket_fd(-1), m_port(port), m_is_server(true), m_connected(false)
-    {
-        if (!setup_server())
-        {
-            throw std::system_error(errno, std::generic_category(), "UDP server setup failed");
-        }
-    }
-    UDPTransport(const UDPTransport&)            = delete;
-    UDPTransport& operator=(const UDPTransport&) = delete;
-    UDPTransport(UDPTransport&&)                 = delete;
-    UDPTransport& operator=(UDPTransport&&)      = delete;
-    ~UDPTransport() override
-    {
-        close();
-    }
-
-    bool send(const uint8_t* data, size_t size) override;
-    size_t receive(uint8_t* buffer, size_t buffer_size) override;
-    bool is_ready() const override
-    {
-        return m_connected;
-    }
-    void close() override;
-
-private:
-    bool setup_client();
-    bool setup_server();
-
-    int m_socket_fd;
-    std::string m_host;
-    int m_port;
+    return to_timetag(std::chrono::system_clock::now());
+}
 
-    bool m_is_server;
-    bool m_connected;
+// Why a packet was rejected. The try_decode* entry points return these instead of throwing.
+enum class PacketError
+{
+    None,
+    AddressUnterminated,   // no NUL terminated address string
+    TypeTagsMissing,       // no type tag string, or one that doesn't start with ','
+    ArgumentsTruncated,    // the arguments run past the end of the packet
+    NotABundle,            // too short for a bundle header, or no "#bundle"
+    ElementSizeTruncated,  // trailing bytes too short to hold an element size
+    ElementTooLarge,       // an element size that runs past the end of the bundle
+    BundleTooDeep,         // bundles nested deeper than BUNDLE_MAX_DEPTH
+    CaptureFailed,         // the server's capture writer failed and was detached
+    HandlerException,      // a handler threw while the packet was dispatched
 };
 
-class OSCClient
-{
-public:
-    explicit OSCClient(std::unique_ptr<Transport> transport) : m_transport(std::move(transport)), m_buffer(BUFFER_MAX_SIZE)
-    {}
+const char* to_string(PacketError error);
 
-    bool send_message(const Message& msg);
-    bool send_bundle(const Bundle& bundle);
-    bool send_packet(const uint8_t* data, size_t size);
+constexpr size_t PACKET_ERROR_COUNT = static_cast<size_t>(PacketError::HandlerException) + 1;
 
-private:
-    std::unique_ptr<Transport> m_transport;
-    std::vector<uint8_t> m_buffer;
-};
+namespace detail {
 
-class OSCServer
+constexpr size_t align4(size_t n)
 {
-public:
-    explicit OSCServer(std::unique_ptr<Transport> transport) : m_transport(std::move(transport)), m_buffer(BUFFER_MAX_SIZE)
-    {}
-
-    using MessageHandler = std::function<void(const Message&)>;
-    using BundleHandler  = std::function<void(const Bundle&)>;
-
-    void set_message_handler(MessageHandler handler)
-    {
-        m_msg_handler = handler;
-    }
+    return (4 - (n & 3)) & 3;
+}
 
-    void set_bundle_handler(BundleHandler handler)
-    {
-        m_bundle_handler = handler;
-    }
+constexpr size_t osc_string_size(size_t length)
+{
+    return length + 1 + align4(length + 1);
+}
 
-    // Non blocking
-    bool process_one();
-    // Blocking
-    int process_all();
+constexpr size_t osc_blob_size(size_t length)
+{
+    return 4 + length + align4(length);
+}
 
-private:
-    std::unique_ptr<Transport> m_transport;
-    std::vector<uint8_t> m_buffer;
-    MessageHandler m_msg_handler;
-    BundleHandler m_bundle_handler;
-};
+// Raw cursor writers: each one checks once that the whole field fits in [out, end), writes it
+// and advances `out`. They return false, leaving `out` untouched, if it does not fit.
 
-namespace detail {
+inline void store_u32_be(uint8_t* p, uint32_t v)
+{
+    p[0] = static_cast<uint8_t>(v >> 24);
+    p[1] = static_cast<uint8_t>(v >> 16);
+    p[2] = static_cast<uint8_t>(v >> 8);
+    p[3] = static_cast<uint8_t>(v);
+}
 
-inline size_t align4(size_t n)
+inline void store_u64_be(uint8_t* p, uint64_t v)
 {
-    return (4 - (n & 3)) & 3;
+    store_u32_be(p, static_cast<uint32_t>(v >> 32));
+    store_u32_be(p + 4, static_cast<uint32_t>(v));
 }
 
-inline void add_osc_u32(std::vector<uint8_t>& out, uint32_t v)
+inline bool add_osc_u32(uint8_t*& out, const uint8_t* end, uint32_t v)
 {
-    out.push_back(static_cast<uint8_t>(v >> 24));
-    out.push_back(static_cast<uint8_t>(v >> 16));
-    out.push_back(static_cast<uint8_t>(v >> 8));
-    out.push_back(static_cast<uint8_t>(v));
+    if (end - out < 4) return false;
+    store_u32_be(out, v);
+    out += 4;
+    return true;
 }
 
-inline void add_osc_u64(std::vector<uint8_t>& out, uint64_t v)
+inline bool add_osc_u64(uint8_t*& out, const uint8_t* end, uint64_t v)
 {
-    out.push_back(static_cast<uint8_t>(v >> 56));
-    out.push_back(static_cast<uint8_t>(v >> 48));
-    out.push_back(static_cast<uint8_t>(v >> 40));
-    out.push_back(static_cast<uint8_t>(v >> 32));
-    out.push_back(static_cast<uint8_t>(v >> 24));
-    out.push_back(static_cast<uint8_t>(v >> 16));
-    out.push_back(static_cast<uint8_t>(v >> 8));
-    out.push_back(static_cast<uint8_t>(v));
+    if (end - out < 8) return false;
+    store_u64_be(out, v);
+    out += 8;
+    return true;
 }
 
-inline void add_osc_int32(std::vector<uint8_t>& out, int32_t v)
+inline bool add_osc_int32(uint8_t*& out, const uint8_t* end, int32_t v)
 {
-    add_osc_u32(out, static_cast<uint32_t>(v));
+    return add_osc_u32(out, end, static_cast<uint32_t>(v));
 }
 
-inline void add_osc_int64(std::vector<uint8_t>& out, int64_t v)
+inline bool add_osc_int64(uint8_t*& out, const uint8_t* end, int64_t v)
 {
-    add_osc_u64(out, static_cast<uint64_t>(v));
+    return add_osc_u64(out, end, static_cast<uint64_t>(v));
 }
 
-inline void add_osc_float32(std::vector<uint8_t>& out, float f)
+inline bool add_osc_float32(uint8_t*& out, const uint8_t* end, float f)
 {
     uint32_t bits = 0;
     std::memcpy(&bits, &f, sizeof bits);
-    add_osc_u32(out, bits);
+    return add_osc_u32(out, end, bits);
 }
 
-inline void add_osc_float64(std::vector<uint8_t>& out, double d)
+inline bool add_osc_float64(uint8_t*& out, const uint8_t* end, double d)
 {
     uint64_t bits = 0;
     std::memcpy(&bits, &d, sizeof bits);
-    add_osc_u64(out, bits);
+    return add_osc_u64(out, end, bits);
 }
 
-inline void add_osc_string(std::vector<uint8_t>& out, std::string_view s)
+inline bool add_osc_string(uint8_t*& out, const uint8_t* end, std::string_view s)
 {
-    out.insert(out.end(), s.begin(), s.end());
-    out.push_back(0x00);
-    size_t pad = align4(s.size() + 1);
-    out.insert(out.end(), pad, uint8_t{0x00});
+    size_t total = osc_string_size(s.size());
+    if (static_cast<size_t>(end - out) < total) return false;
+    std::memcpy(out, s.data(), s.size());
+    std::memset(out + s.size(), 0x00, total - s.size());
+    out += total;
+    return true;
 }
 
-inline void add_osc_blob(std::vector<uint8_t>& out, const uint8_t* data, size_t size)
+inline bool add_osc_blob(uint8_t*& out, const uint8_t* end, const uint8_t* data, size_t size)
 {
-    add_osc_u32(out, static_cast<uint32_t>(size));
-    out.insert(out.end(), data, data + size);
-    size_t pad = align4(size);
-    out.insert(out.end(), pad, uint8_t{0x00});
+    size_t total = osc_blob_size(size);
+    if (static_cast<size_t>(end - out) < total) return false;
+    store_u32_be(out, static_cast<uint32_t>(size));
+    if (size > 0) std::memcpy(out + 4, data, size);
+    std::memset(out + 4 + size, 0x00, total - 4 - size);
+    out += total;
+    return true;
 }
 
 inline uint32_t read_u32_be(const uint8_t* p)
@@ -283,11 +235,22 @@ inline uint64_t read_u64_be(const uint8_t* p)
            (uint64_t(p[4]) << 24) | (uint64_t(p[5]) << 16) | (uint64_t(p[6]) << 8) | (uint64_t(p[7]));
 }
 
+// Byte-swaps `count` consecutive 32-bit words from src to dst (which may alias), converting
+// between big-endian wire order and host order. Uses AVX2, SSE2 or NEON when the build
+// targets them and a scalar loop otherwise; on big-endian hosts it is a plain copy.
+void byteswap32_run(const uint8_t* src, uint8_t* dst, size_t count);
+
 inline bool is_bundle(const uint8_t* p)
 {
     return std::memcmp(p, BUNDLE_ID.data(), 8) == 0;
 }
 
+// Returns the index of the first NUL byte in [p, p + n), or n if there is none. Scans 16 bytes
+// at a time with SSE2 and a 64-bit word at a time otherwise.
+size_t find_nul(const uint8_t* p, size_t n);
+
+// The read_osc_* helpers below do no bounds checking of their own. They're the second phase of
+// decoding and must only be used on a packet that validate_osc_message() has accepted.
 inline int32_t read_osc_int32(const uint8_t* p, size_t& offset)
 {
     auto i  = static_cast<int32_t>(read_u32_be(p + offset));
@@ -313,15 +276,13 @@ inline float read_osc_float32(const uint8_t* p, size_t& offset)
 
 inline double read_osc_float64(const uint8_t* p, size_t& offset)
 {
-    uint32_t bits = read_u64_be(p + offset);
+    uint64_t bits = read_u64_be(p + offset);
     double d      = 0.0;
     std::memcpy(&d, &bits, sizeof(d));
     offset += 8;
     return d;
 }
 
-
-
 inline uint64_t read_osc_timetag(const uint8_t* p, size_t& offset)
 {
     auto i  = read_u64_be(p + offset);
@@ -329,30 +290,3453 @@ inline uint64_t read_osc_timetag(const uint8_t* p, size_t& offset)
     return i;
 }
 
-inline bool read_osc_string(std::string& out, const uint8_t* data, size_t size, size_t& offset)
+inline void read_osc_string(std::string& out, const uint8_t* data, size_t& offset)
 {
-    size_t start = offset;
-    while (offset < size && data[offset] != 0x00) ++offset;
-    if (offset >= size) throw std::runtime_error("OSC String is not terminated");
-    out.assign(reinterpret_cast<const char*>(data + start), offset - start);
-    offset = (offset + 4) & ~0x3;
-    return true;
+    size_t len = std::strlen(reinterpret_cast<const char*>(data + offset));
+    out.assign(reinterpret_cast<const char*>(data + offset), len);
+    offset += len + 1 + align4(len + 1);
 }
 
-inline bool read_osc_blob(std::vector<uint8_t>& out, const uint8_t* data, size_t size, size_t& offset)
+inline void read_osc_blob(std::vector<uint8_t>& out, const uint8_t* data, size_t& offset)
 {
-    if (offset + 4 > size) return false;
-    uint32_t len  = read_u32_be(data + offset);
-    offset       += 4;
-    if (offset + len > size) return false;
-    out.assign(data + offset, data + offset + len);
-    offset += len;
-    offset  = (offset + 4) & ~0x3;
+    size_t len = read_u32_be(data + offset);
+    out.assign(data + offset + 4, data + offset + 4 + len);
+    offset += 4 + len + align4(len);
+}
+
+// Locates the payload of one argument without copying it. On success `payload` points at the
+// argument's first byte, `length` is its unpadded size and `offset` is advanced past the padding.
+inline bool view_osc_argument(
+    char tag, const uint8_t* data, size_t size, size_t& offset, const uint8_t*& payload, size_t& length
+)
+{
+    payload = data + offset;
+    switch (tag)
+    {
+        case 'i':
+        case 'f':
+        case 'c':
+        case 'r':
+        case 'm':
+            length = 4;
+            break;
+        case 'h':
+        case 'd':
+        case 't':
+            length = 8;
+            break;
+        case 'S':
+        case 's': {
+            if (offset >= size) return false;
+            length = find_nul(payload, size - offset);
+            if (length == size - offset) return false;
+            offset += length + 1 + align4(length + 1);
+            return offset <= size;
+        }
+        case 'b': {
+            if (offset + 4 > size) return false;
+            length   = read_u32_be(payload);
+            payload += 4;
+            if (length > size - offset - 4) return false;
+            offset += 4 + length + align4(length);
+            return offset <= size;
+        }
+        default:
+            // T, F, N, I and unknown tags carry no payload
+            length = 0;
+            return true;
+    }
+    if (length > size - offset) return false;
+    offset += length;
     return true;
 }
 
+// Where the parts of a validated message live in its packet
+struct MessageLayout
+{
+    std::string_view address;
+    std::string_view tags;
+    size_t args_offset {0};
+};
+
+// First phase of decoding: one pass that checks the address, the type tag string and every
+// argument against the packet size, reporting truncated or corrupt packets.
+inline PacketError validate_osc_message(const uint8_t* data, size_t size, MessageLayout& layout)
+{
+    size_t offset          = 0;
+    const uint8_t* payload = nullptr;
+    size_t length          = 0;
+    if (!view_osc_argument('s', data, size, offset, payload, length)) return PacketError::AddressUnterminated;
+    layout.address = {reinterpret_cast<const char*>(payload), length};
+    if (!view_osc_argument('s', data, size, offset, payload, length) || length == 0 || payload[0] != ',')
+    {
+        return PacketError::TypeTagsMissing;
+    }
+    layout.tags        = {reinterpret_cast<const char*>(payload), length};
+    layout.args_offset = offset;
+    for (char tag : layout.tags.substr(1))
+    {
+        if (!view_osc_argument(tag, data, size, offset, payload, length)) return PacketError::ArgumentsTruncated;
+    }
+    return PacketError::None;
+}
+
+// FNV-1a, used to spread addresses across shards
+inline uint32_t hash_osc_address(std::string_view address)
+{
+    uint32_t h = 2166136261u;
+    for (char c : address)
+    {
+        h ^= static_cast<uint8_t>(c);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+inline bool is_osc_pattern(std::string_view s)
+{
+    return s.find_first_of("*?[]{}") != std::string_view::npos;
+}
+
+// OSC 1.0 address pattern matching for a single path segment: '?' matches one character, '*'
+// any run of characters, "[a-z]" / "[!abc]" a character set and "{foo,bar}" one of several strings.
+inline bool match_osc_pattern(std::string_view pattern, std::string_view name)
+{
+    size_t p = 0;
+    size_t n = 0;
+    while (p < pattern.size())
+    {
+        switch (pattern[p])
+        {
+            case '*': {
+                while (p < pattern.size() && pattern[p] == '*') ++p;
+                if (p == pattern.size()) return true;
+                for (size_t k = n; k <= name.size(); ++k)
+                {
+                    if (match_osc_pattern(pattern.substr(p), name.substr(k))) return true;
+                }
+                return false;
+            }
+            case '?':
+                if (n >= name.size()) return false;
+                ++p;
+                ++n;
+                break;
+            case '[': {
+                size_t close = pattern.find(']', p + 1);
+                if (close == std::string_view::npos || n >= name.size()) return false;
+                std::string_view set = pattern.substr(p + 1, close - p - 1);
+                bool negate          = !set.empty() && set[0] == '!';
+                if (negate) set.remove_prefix(1);
+                bool found = false;
+                char c     = name[n];
+                for (size_t i = 0; i < set.size() && !found; ++i)
+                {
+                    if (i + 2 < set.size() && set[i + 1] == '-')
+                    {
+                        found  = set[i] <= c && c <= set[i + 2];
+                        i     += 2;
+                    }
+                    else
+                    {
+                        found = set[i] == c;
+                    }
+                }
+                if (found == negate) return false;
+                p = close + 1;
+                ++n;
+                break;
+            }
+            case '{': {
+                size_t close = pattern.find('}', p + 1);
+                if (close == std::string_view::npos) return false;
+                std::string_view options = pattern.substr(p + 1, close - p - 1);
+                std::string_view rest    = pattern.substr(close + 1);
+                std::string_view tail    = name.substr(n);
+                for (;;)
+                {
+                    size_t comma            = options.find(',');
+                    std::string_view option = options.substr(0, comma);
+                    if (tail.substr(0, option.size()) == option &&
+                        match_osc_pattern(rest, tail.substr(option.size())))
+                    {
+                        return true;
+                    }
+                    if (comma == std::string_view::npos) return false;
+                    options.remove_prefix(comma + 1);
+                }
+            }
+            default:
+                if (n >= name.size() || name[n] != pattern[p]) return false;
+                ++p;
+                ++n;
+                break;
+        }
+    }
+    return n == name.size();
+}
+
+// Matches a whole address against a pattern one '/'-separated segment at a time
+inline bool match_osc_address(std::string_view pattern, std::string_view address)
+{
+    while (!pattern.empty() && !address.empty())
+    {
+        if (pattern[0] != '/' || address[0] != '/') return false;
+        pattern.remove_prefix(1);
+        address.remove_prefix(1);
+        size_t p = std::min(pattern.find('/'), pattern.size());
+        size_t a = std::min(address.find('/'), address.size());
+        if (!match_osc_pattern(pattern.substr(0, p), address.substr(0, a))) return false;
+        pattern.remove_prefix(p);
+        address.remove_prefix(a);
+    }
+    return pattern.empty() && address.empty();
+}
+
 }  // namespace detail
 
+class Message
+{
+public:
+    std::string address;
+    std::string tags;
+    std::vector<OSCValue> arguments;
+
+    explicit Message(const std::string& addr) : address(addr)
+    {
+        tags.push_back(',');
+    }
+
+    void clear()
+    {
+        tags.assign(1, ',');
+        arguments.clear();
+    }
+    void add_int32(int32_t value)
+    {
+        tags.push_back('i');
+        arguments.emplace_back(value);
+    }
+    void add_int64(int64_t value)
+    {
+        tags.push_back('h');
+        arguments.emplace_back(value);
+    }
+    void add_float(float value)
+    {
+        tags.push_back('f');
+        arguments.emplace_back(value);
+    }
+    void add_string(const std::string& value)
+    {
+        tags.push_back('s');
+        arguments.emplace_back(value);
+    }
+    void add_blob(const uint8_t* data, size_t size)
+    {
+        tags.push_back('b');
+        arguments.emplace_back(OSCBlob(data, data + size));
+    }
+    // OSC 1.1 arrays: the brackets only appear in the tag string and carry no data
+    void begin_array()
+    {
+        tags.push_back('[');
+    }
+    void end_array()
+    {
+        tags.push_back(']');
+    }
+    void add_float_array(const float* values, size_t count)
+    {
+        begin_array();
+        tags.append(count, 'f');
+        arguments.insert(arguments.end(), values, values + count);
+        end_array();
+    }
+
+    // Exact number of bytes encode() / encode_into() will produce
+    size_t encoded_size() const;
+    std::vector<uint8_t> encode() const;
+    // Encodes into caller-owned memory. Returns the number of bytes written, or 0 if `cap` is too small.
+    size_t encode_into(uint8_t* dst, size_t cap) const;
+    static Message decode(const uint8_t* data, size_t size);
+    // Decodes over an existing message, reusing the storage of its strings, blobs and argument list
+    static void decode_into(Message& msg, const uint8_t* data, size_t size);
+    // decode_into() that reports malformed packets instead of throwing; only allocation can throw
+    static PacketError try_decode_into(Message& msg, const uint8_t* data, size_t size);
+};
+
+class Bundle
+{
+public:
+    std::vector<Message> messages;
+    std::vector<Bundle> bundles;
+    OSCTimeTag timetag {1};
+
+    Bundle() = default;
+
+    void clear()
+    {
+        messages.clear();
+        bundles.clear();
+        timetag = 1;
+    }
+
+    void add_message(const Message& msg)
+    {
+        messages.emplace_back(msg);
+    }
+
+    void add_message(Message&& msg)
+    {
+        messages.emplace_back(std::move(msg));
+    }
+
+    void add_bundle(const Bundle& bundle)
+    {
+        bundles.emplace_back(bundle);
+    }
+
+    void add_bundle(Bundle&& bundle)
+    {
+        bundles.emplace_back(std::move(bundle));
+    }
+
+
+    // Exact number of bytes encode() / encode_into() will produce, including nested elements
+    size_t encoded_size() const;
+    std::vector<uint8_t> encode() const;
+    // Encodes into caller-owned memory. Returns the number of bytes written, or 0 if `cap` is too small.
+    size_t encode_into(uint8_t* dst, size_t cap) const;
+    static Bundle decode(const uint8_t* data, size_t size);
+    // Decodes over an existing bundle, reusing its nested messages and bundles where possible
+    static void decode_into(Bundle& bundle, const uint8_t* data, size_t size);
+    // decode_into() that reports malformed packets instead of throwing; only allocation can throw
+    static PacketError try_decode_into(Bundle& bundle, const uint8_t* data, size_t size);
+};
+
+// Non-owning views into a received packet. They are only valid while the underlying buffer is,
+// which for OSCServer handlers means for the duration of the callback.
+
+struct BlobView
+{
+    const uint8_t* data {nullptr};
+    size_t size {0};
+
+    // Decodes the blob as packed big-endian floats, returns how many were written to `out`
+    size_t read_floats(float* out, size_t max) const;
+};
+
+class ArgumentView
+{
+public:
+    ArgumentView() = default;
+    ArgumentView(char tag, const uint8_t* data, size_t size) : m_tag(tag), m_data(data), m_size(size)
+    {}
+
+    char tag() const
+    {
+        return m_tag;
+    }
+    // Raw big-endian payload; for blobs this is past the size prefix
+    const uint8_t* payload() const
+    {
+        return m_data;
+    }
+    size_t payload_size() const
+    {
+        return m_size;
+    }
+
+    int32_t as_int32() const
+    {
+        expect('i');
+        return static_cast<int32_t>(detail::read_u32_be(m_data));
+    }
+    int64_t as_int64() const
+    {
+        expect('h');
+        return static_cast<int64_t>(detail::read_u64_be(m_data));
+    }
+    float as_float() const
+    {
+        expect('f');
+        uint32_t bits = detail::read_u32_be(m_data);
+        float f       = 0.0f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+    double as_float64() const
+    {
+        expect('d');
+        uint64_t bits = detail::read_u64_be(m_data);
+        double d      = 0.0;
+        std::memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+    OSCTimeTag as_timetag() const
+    {
+        expect('t');
+        return detail::read_u64_be(m_data);
+    }
+    std::string_view as_string() const
+    {
+        if (m_tag != 'S') expect('s');
+        return {reinterpret_cast<const char*>(m_data), m_size};
+    }
+    BlobView as_blob() const
+    {
+        expect('b');
+        return {m_data, m_size};
+    }
+
+private:
+    void expect(char tag) const
+    {
+        if (m_tag != tag) throw std::runtime_error("OSC argument type mismatch");
+    }
+
+    char m_tag {0};
+    const uint8_t* m_data {nullptr};
+    size_t m_size {0};
+};
+
+class MessageView
+{
+public:
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = ArgumentView;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const ArgumentView*;
+        using reference         = const ArgumentView&;
+
+        const_iterator() = default;
+        const_iterator(const char* tag, const uint8_t* data, size_t size, size_t offset)
+            : m_tag(tag), m_data(data), m_size(size), m_offset(offset)
+        {
+            load();
+        }
+
+        reference operator*() const
+        {
+            return m_current;
+        }
+        pointer operator->() const
+        {
+            return &m_current;
+        }
+        const_iterator& operator++()
+        {
+            ++m_tag;
+            load();
+            return *this;
+        }
+        const_iterator operator++(int)
+        {
+            const_iterator prev = *this;
+            ++*this;
+            return prev;
+        }
+        bool operator==(const const_iterator& other) const
+        {
+            return m_tag == other.m_tag;
+        }
+        bool operator!=(const const_iterator& other) const
+        {
+            return m_tag != other.m_tag;
+        }
+
+    private:
+        void load()
+        {
+            if (m_data == nullptr || *m_tag == 0x00) return;
+            const uint8_t* payload = nullptr;
+            size_t length          = 0;
+            // The layout was validated by MessageView::decode, so this cannot fail
+            detail::view_osc_argument(*m_tag, m_data, m_size, m_offset, payload, length);
+            m_current = ArgumentView(*m_tag, payload, length);
+        }
+
+        const char* m_tag {nullptr};
+        const uint8_t* m_data {nullptr};
+        size_t m_size {0};
+        size_t m_offset {0};
+        ArgumentView m_current;
+    };
+
+    std::string_view address;
+    std::string_view tags;
+
+    size_t size() const
+    {
+        return tags.empty() ? 0 : tags.size() - 1;
+    }
+    const_iterator begin() const
+    {
+        if (tags.empty()) return end();
+        return {tags.data() + 1, m_data, m_size, m_args_offset};
+    }
+    const_iterator end() const
+    {
+        return {tags.data() + tags.size(), nullptr, 0, 0};
+    }
+    // Walks the argument list, prefer iterating when visiting every argument
+    ArgumentView operator[](size_t index) const;
+
+    // Bulk decode of the run of consecutive 'f' (or 'i') arguments starting at `index`. An index
+    // pointing at an array's '[' starts at its first element. Returns how many values were
+    // written to `out`, which is at most `max`.
+    size_t read_float_run(size_t index, float* out, size_t max) const;
+    size_t read_int32_run(size_t index, int32_t* out, size_t max) const;
+    std::vector<float> float_run(size_t index) const;
+
+    // Copies the viewed data into an owning Message
+    Message to_message() const;
+
+    static MessageView decode(const uint8_t* data, size_t size);
+    static PacketError try_decode(const uint8_t* data, size_t size, MessageView& out) noexcept;
+
+private:
+    friend class CompactMessage;
+
+    const uint8_t* m_data {nullptr};
+    size_t m_size {0};
+    size_t m_args_offset {0};
+};
+
+class BundleView
+{
+public:
+    class Element
+    {
+    public:
+        const uint8_t* data {nullptr};
+        size_t size {0};
+
+        bool is_bundle() const
+        {
+            return size >= BUNDLE_ID.size() && detail::is_bundle(data);
+        }
+        // A message's address without decoding anything else, for filtering before message().
+        // Empty for bundles and unterminated addresses.
+        std::string_view address() const noexcept
+        {
+            if (is_bundle()) return {};
+            size_t length = detail::find_nul(data, size);
+            if (length == size) return {};
+            return {reinterpret_cast<const char*>(data), length};
+        }
+        MessageView message() const
+        {
+            return MessageView::decode(data, size);
+        }
+        BundleView bundle() const
+        {
+            return BundleView::decode(data, size);
+        }
+        // The element decoded on demand: try_bundle() checks only the nested bundle's own framing,
+        // like try_decode_lazy(). Needed to access elements of a lazily decoded bundle safely.
+        PacketError try_message(MessageView& out) const noexcept
+        {
+            return MessageView::try_decode(data, size, out);
+        }
+        PacketError try_bundle(BundleView& out) const noexcept
+        {
+            return BundleView::try_decode_lazy(data, size, out);
+        }
+    };
+
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = Element;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const Element*;
+        using reference         = const Element&;
+
+        const_iterator() = default;
+        const_iterator(const uint8_t* pos, const uint8_t* end) : m_pos(pos), m_end(end)
+        {
+            load();
+        }
+
+        reference operator*() const
+        {
+            return m_current;
+        }
+        pointer operator->() const
+        {
+            return &m_current;
+        }
+        const_iterator& operator++()
+        {
+            m_pos = m_current.data + m_current.size;
+            load();
+            return *this;
+        }
+        const_iterator operator++(int)
+        {
+            const_iterator prev = *this;
+            ++*this;
+            return prev;
+        }
+        bool operator==(const const_iterator& other) const
+        {
+            return m_pos == other.m_pos;
+        }
+        bool operator!=(const const_iterator& other) const
+        {
+            return m_pos != other.m_pos;
+        }
+
+    private:
+        void load()
+        {
+            if (m_pos >= m_end) return;
+            // Element sizes were validated by BundleView::decode
+            m_current.data = m_pos + 4;
+            m_current.size = detail::read_u32_be(m_pos);
+        }
+
+        const uint8_t* m_pos {nullptr};
+        const uint8_t* m_end {nullptr};
+        Element m_current;
+    };
+
+    OSCTimeTag timetag {1};
+
+    const_iterator begin() const
+    {
+        return {m_elements, m_end};
+    }
+    const_iterator end() const
+    {
+        return {m_end, m_end};
+    }
+
+    // Validates nested bundles and messages as well, so iterating the view cannot fail later
+    static BundleView decode(const uint8_t* data, size_t size);
+    static PacketError try_decode(const uint8_t* data, size_t size, BundleView& out) noexcept;
+    // Checks the header and that this level's element sizes add up, nothing inside the elements.
+    // Each element is then validated only if it is accessed through try_message()/try_bundle(),
+    // so skipping elements by is_bundle() or address() costs a size read each.
+    static BundleView decode_lazy(const uint8_t* data, size_t size);
+    static PacketError try_decode_lazy(const uint8_t* data, size_t size, BundleView& out) noexcept;
+
+private:
+    const uint8_t* m_elements {nullptr};
+    const uint8_t* m_end {nullptr};
+};
+
+namespace detail {
+
+// Wire mapping of the fixed-width argument types TypedMessage accepts
+template <typename T>
+struct osc_type;
+
+template <>
+struct osc_type<int32_t>
+{
+    static constexpr char tag    = 'i';
+    static constexpr size_t size = 4;
+    static void store(uint8_t* p, int32_t v)
+    {
+        store_u32_be(p, static_cast<uint32_t>(v));
+    }
+    static int32_t load(const uint8_t* p)
+    {
+        return static_cast<int32_t>(read_u32_be(p));
+    }
+};
+
+template <>
+struct osc_type<int64_t>
+{
+    static constexpr char tag    = 'h';
+    static constexpr size_t size = 8;
+    static void store(uint8_t* p, int64_t v)
+    {
+        store_u64_be(p, static_cast<uint64_t>(v));
+    }
+    static int64_t load(const uint8_t* p)
+    {
+        return static_cast<int64_t>(read_u64_be(p));
+    }
+};
+
+template <>
+struct osc_type<OSCTimeTag>
+{
+    static constexpr char tag    = 't';
+    static constexpr size_t size = 8;
+    static void store(uint8_t* p, OSCTimeTag v)
+    {
+        store_u64_be(p, v);
+    }
+    static OSCTimeTag load(const uint8_t* p)
+    {
+        return read_u64_be(p);
+    }
+};
+
+template <>
+struct osc_type<float>
+{
+    static constexpr char tag    = 'f';
+    static constexpr size_t size = 4;
+    static void store(uint8_t* p, float v)
+    {
+        uint32_t bits = 0;
+        std::memcpy(&bits, &v, sizeof bits);
+        store_u32_be(p, bits);
+    }
+    static float load(const uint8_t* p)
+    {
+        uint32_t bits = read_u32_be(p);
+        float f       = 0.0f;
+        std::memcpy(&f, &bits, sizeof f);
+        return f;
+    }
+};
+
+template <>
+struct osc_type<double>
+{
+    static constexpr char tag    = 'd';
+    static constexpr size_t size = 8;
+    static void store(uint8_t* p, double v)
+    {
+        uint64_t bits = 0;
+        std::memcpy(&bits, &v, sizeof bits);
+        store_u64_be(p, bits);
+    }
+    static double load(const uint8_t* p)
+    {
+        uint64_t bits = read_u64_be(p);
+        double d      = 0.0;
+        std::memcpy(&d, &bits, sizeof d);
+        return d;
+    }
+};
+
+constexpr size_t constexpr_strlen(const char* s)
+{
+    size_t n = 0;
+    while (s[n] != 0) ++n;
+    return n;
+}
+
+}  // namespace detail
+
+namespace detail {
+
+// Byte buffer that keeps up to N bytes inline and only moves to the heap beyond that
+template <size_t N>
+class SmallByteBuffer
+{
+public:
+    SmallByteBuffer() = default;
+    SmallByteBuffer(const SmallByteBuffer& other)
+    {
+        std::memcpy(extend(other.m_size), other.data(), other.m_size);
+    }
+    SmallByteBuffer(SmallByteBuffer&& other) noexcept
+    {
+        *this = std::move(other);
+    }
+    SmallByteBuffer& operator=(const SmallByteBuffer& other)
+    {
+        if (this != &other)
+        {
+            m_size = 0;
+            std::memcpy(extend(other.m_size), other.data(), other.m_size);
+        }
+        return *this;
+    }
+    SmallByteBuffer& operator=(SmallByteBuffer&& other) noexcept
+    {
+        if (this == &other) return *this;
+        m_size = other.m_size;
+        if (other.m_heap)
+        {
+            m_heap     = std::move(other.m_heap);
+            m_capacity = other.m_capacity;
+        }
+        else
+        {
+            m_heap.reset();
+            m_capacity = N;
+            std::memcpy(m_inline, other.m_inline, other.m_size);
+        }
+        other.m_size     = 0;
+        other.m_capacity = N;
+        return *this;
+    }
+
+    const uint8_t* data() const
+    {
+        return m_heap ? m_heap.get() : m_inline;
+    }
+    size_t size() const
+    {
+        return m_size;
+    }
+    void clear()
+    {
+        m_size = 0;
+    }
+
+    // Grows the buffer by n bytes and returns a pointer to them
+    uint8_t* extend(size_t n)
+    {
+        if (m_size + n > m_capacity)
+        {
+            size_t capacity = std::max(m_capacity * 2, m_size + n);
+            auto heap       = std::make_unique<uint8_t[]>(capacity);
+            std::memcpy(heap.get(), data(), m_size);
+            m_heap     = std::move(heap);
+            m_capacity = capacity;
+        }
+        uint8_t* p  = (m_heap ? m_heap.get() : m_inline) + m_size;
+        m_size     += n;
+        return p;
+    }
+
+private:
+    size_t m_size {0};
+    size_t m_capacity {N};
+    std::unique_ptr<uint8_t[]> m_heap;
+    uint8_t m_inline[N];
+};
+
+}  // namespace detail
+
+// Message with the same builder API as Message, but whose arguments are kept already encoded in
+// one flat buffer with inline storage, using the tag string as the type index. A message with a
+// handful of numeric arguments is a single object with no heap blocks, which makes it cheap to
+// keep in large queues. Typed access goes through view().
+class CompactMessage
+{
+public:
+    static constexpr size_t INLINE_ARGUMENT_BYTES = 48;
+
+    std::string address;
+    std::string tags;
+
+    explicit CompactMessage(const std::string& addr) : address(addr)
+    {
+        tags.push_back(',');
+    }
+    explicit CompactMessage(const Message& msg);
+
+    void clear()
+    {
+        tags.assign(1, ',');
+        m_args.clear();
+    }
+    void add_int32(int32_t value)
+    {
+        tags.push_back('i');
+        detail::osc_type<int32_t>::store(m_args.extend(4), value);
+    }
+    void add_float(float value)
+    {
+        tags.push_back('f');
+        detail::osc_type<float>::store(m_args.extend(4), value);
+    }
+    void add_string(std::string_view value)
+    {
+        tags.push_back('s');
+        uint8_t* p = m_args.extend(detail::osc_string_size(value.size()));
+        std::memcpy(p, value.data(), value.size());
+        std::memset(p + value.size(), 0x00, detail::osc_string_size(value.size()) - value.size());
+    }
+    void add_blob(const uint8_t* data, size_t size)
+    {
+        tags.push_back('b');
+        uint8_t* p = m_args.extend(detail::osc_blob_size(size));
+        detail::store_u32_be(p, static_cast<uint32_t>(size));
+        if (size > 0) std::memcpy(p + 4, data, size);
+        std::memset(p + 4 + size, 0x00, detail::osc_blob_size(size) - 4 - size);
+    }
+    void begin_array()
+    {
+        tags.push_back('[');
+    }
+    void end_array()
+    {
+        tags.push_back(']');
+    }
+    // Encodes the whole array with one vectorised byte swap
+    void add_float_array(const float* values, size_t count)
+    {
+        begin_array();
+        tags.append(count, 'f');
+        detail::byteswap32_run(reinterpret_cast<const uint8_t*>(values), m_args.extend(count * 4), count);
+        end_array();
+    }
+
+    // Typed, zero-copy access to the arguments. Invalidated by the add_* calls.
+    MessageView view() const
+    {
+        MessageView v;
+        v.address = address;
+        v.tags    = {tags.c_str(), tags.size()};
+        v.m_data  = m_args.data();
+        v.m_size  = m_args.size();
+        return v;
+    }
+    Message to_message() const
+    {
+        return view().to_message();
+    }
+
+    size_t encoded_size() const
+    {
+        return detail::osc_string_size(address.size()) + detail::osc_string_size(tags.size()) + m_args.size();
+    }
+    std::vector<uint8_t> encode() const
+    {
+        std::vector<uint8_t> buffer(encoded_size());
+        encode_into(buffer.data(), buffer.size());
+        return buffer;
+    }
+    // Encodes into caller-owned memory. Returns the number of bytes written, or 0 if `cap` is too small.
+    size_t encode_into(uint8_t* dst, size_t cap) const
+    {
+        uint8_t* out       = dst;
+        const uint8_t* end = dst + cap;
+        if (!detail::add_osc_string(out, end, address) || !detail::add_osc_string(out, end, tags) ||
+            static_cast<size_t>(end - out) < m_args.size())
+        {
+            return 0;
+        }
+        std::memcpy(out, m_args.data(), m_args.size());
+        return static_cast<size_t>(out - dst) + m_args.size();
+    }
+    static CompactMessage decode(const uint8_t* data, size_t size);
+
+private:
+    detail::SmallByteBuffer<INLINE_ARGUMENT_BYTES> m_args;
+};
+
+// A message whose address and argument types are fixed at compile time. The padded address and
+// tag string are built as a constexpr byte array, encoding writes the arguments behind it into a
+// std::array and decoding checks the whole header with a single memcmp. Only fixed-width types
+// (int32_t, int64_t, float, double and OSCTimeTag) are supported. C++17 cannot take a string
+// literal as a template argument, so the address is a named constexpr array:
+//
+//     static constexpr char gain_address[] = "/mixer/ch/gain";
+//     using Gain = NanoOsc::TypedMessage<gain_address, int32_t, float>;
+//     auto packet = Gain::encode(3, 0.5f);
+//     auto [channel, gain] = Gain::decode(data, size);
+template <const char* Address, typename... Args>
+class TypedMessage
+{
+public:
+    using Tuple = std::tuple<Args...>;
+
+    static constexpr size_t address_length = detail::constexpr_strlen(Address);
+    static constexpr size_t header_size =
+        detail::osc_string_size(address_length) + detail::osc_string_size(1 + sizeof...(Args));
+    static constexpr size_t size = header_size + (size_t {0} + ... + detail::osc_type<Args>::size);
+
+    // Address and tag string exactly as they appear on the wire
+    static constexpr std::array<uint8_t, header_size> header = []()
+    {
+        std::array<uint8_t, header_size> bytes {};
+        size_t i = 0;
+        for (; i < address_length; ++i) bytes[i] = static_cast<uint8_t>(Address[i]);
+        size_t t = detail::osc_string_size(address_length);
+        bytes[t] = ',';
+        ((bytes[++t] = static_cast<uint8_t>(detail::osc_type<Args>::tag)), ...);
+        return bytes;
+    }();
+
+    static std::array<uint8_t, size> encode(const Args&... args)
+    {
+        std::array<uint8_t, size> packet;
+        std::memcpy(packet.data(), header.data(), header_size);
+        [[maybe_unused]] uint8_t* p = packet.data() + header_size;
+        ((detail::osc_type<Args>::store(p, args), p += detail::osc_type<Args>::size), ...);
+        return packet;
+    }
+
+    // True if the packet has exactly this address, tag string and size
+    static bool matches(const uint8_t* data, size_t length)
+    {
+        return length == size && std::memcmp(data, header.data(), header_size) == 0;
+    }
+
+    static Tuple decode(const uint8_t* data, size_t length)
+    {
+        if (!matches(data, length))
+        {
+            throw std::runtime_error("OSC packet does not match the typed message layout");
+        }
+        const uint8_t* p = data + header_size;
+        return load_all(p, std::index_sequence_for<Args...> {});
+    }
+
+private:
+    template <size_t... I>
+    static Tuple load_all([[maybe_unused]] const uint8_t* p, std::index_sequence<I...>)
+    {
+        // Braced initialisation evaluates the loads left to right
+        return Tuple {detail::osc_type<Args>::load(p + offset_of<I>())...};
+    }
+
+    template <size_t I>
+    static constexpr size_t offset_of()
+    {
+        constexpr size_t sizes[] = {detail::osc_type<Args>::size..., 0};
+        size_t offset            = 0;
+        for (size_t i = 0; i < I; ++i) offset += sizes[i];
+        return offset;
+    }
+};
+
+// A pre-encoded Message or Bundle whose fixed-width arguments can be overwritten in place. The
+// template remembers where every argument lives in the encoded bytes, so resending with new
+// values is a few setter writes plus one send_packet(), without going through encode() again.
+// Arguments are numbered in wire order; for bundles that runs across every nested message.
+class PacketTemplate
+{
+public:
+    explicit PacketTemplate(const Message& msg);
+    explicit PacketTemplate(const Bundle& bundle);
+
+    const uint8_t* data() const
+    {
+        return m_bytes.data();
+    }
+    size_t size() const
+    {
+        return m_bytes.size();
+    }
+    size_t argument_count() const
+    {
+        return m_slots.size();
+    }
+    char tag(size_t index) const
+    {
+        return m_slots.at(index).tag;
+    }
+
+    void set_int32(size_t index, int32_t value)
+    {
+        detail::osc_type<int32_t>::store(slot(index, 'i'), value);
+    }
+    void set_int64(size_t index, int64_t value)
+    {
+        detail::osc_type<int64_t>::store(slot(index, 'h'), value);
+    }
+    void set_float(size_t index, float value)
+    {
+        detail::osc_type<float>::store(slot(index, 'f'), value);
+    }
+    void set_float64(size_t index, double value)
+    {
+        detail::osc_type<double>::store(slot(index, 'd'), value);
+    }
+    void set_timetag(size_t index, OSCTimeTag value)
+    {
+        detail::osc_type<OSCTimeTag>::store(slot(index, 't'), value);
+    }
+    // Only for templates built from a Bundle: overwrites the outer bundle's timetag
+    void set_bundle_timetag(OSCTimeTag value);
+
+private:
+    struct Slot
+    {
+        uint32_t offset;
+        char tag;
+    };
+
+    uint8_t* slot(size_t index, char tag)
+    {
+        const Slot& s = m_slots.at(index);
+        if (s.tag != tag) throw std::runtime_error("OSC argument type mismatch");
+        return m_bytes.data() + s.offset;
+    }
+    void index_message(const MessageView& msg);
+    void index_bundle(const BundleView& bundle);
+
+    std::vector<uint8_t> m_bytes;
+    std::vector<Slot> m_slots;
+};
+
+// Log-bucketed histogram in the style of HdrHistogram: every power of two is split into four
+// linear sub-buckets, so a sample is never more than 25% above its bucket's lower bound.
+// Recording is a single relaxed increment.
+class Histogram
+{
+public:
+    static constexpr size_t SUB_BUCKETS = 4;
+    static constexpr size_t BUCKETS     = 63 * SUB_BUCKETS;
+    using Counts                        = std::array<uint64_t, BUCKETS>;
+
+    static size_t bucket_of(uint64_t value)
+    {
+        if (value < SUB_BUCKETS) return static_cast<size_t>(value);
+        size_t msb = 63 - static_cast<size_t>(__builtin_clzll(value));
+        return (msb - 1) * SUB_BUCKETS + ((value >> (msb - 2)) & (SUB_BUCKETS - 1));
+    }
+    static uint64_t lower_bound(size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS) return bucket;
+        return uint64_t(SUB_BUCKETS + bucket % SUB_BUCKETS) << (bucket / SUB_BUCKETS - 1);
+    }
+
+    void record(uint64_t value)
+    {
+        m_counts[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+    }
+    void read(Counts& out) const
+    {
+        for (size_t i = 0; i < BUCKETS; ++i) out[i] = m_counts[i].load(std::memory_order_relaxed);
+    }
+    // Exact total of every recorded value, for averages the buckets can only approximate
+    uint64_t sum() const
+    {
+        return m_sum.load(std::memory_order_relaxed);
+    }
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> m_counts {};
+    std::atomic<uint64_t> m_sum {0};
+};
+
+// A point-in-time copy of Stats, safe to read, merge and export at leisure
+struct StatsSnapshot
+{
+    uint64_t packets_received {0};
+    uint64_t bytes_received {0};
+    uint64_t packets_sent {0};
+    uint64_t bytes_sent {0};
+    uint64_t send_failures {0};
+    // Sends refused with EAGAIN / EWOULDBLOCK, also counted in send_failures
+    uint64_t send_would_block {0};
+    uint64_t messages_dispatched {0};
+    uint64_t bundles_dispatched {0};
+    // Datagrams the kernel dropped because the socket's receive queue was full, from transports
+    // with UDPTransportOptions::rxq_overflow set
+    uint64_t kernel_drops {0};
+    // Packets the transport dropped because they didn't fit the buffer they were received into
+    uint64_t oversized_drops {0};
+    // Indexed by PacketError
+    std::array<uint64_t, PACKET_ERROR_COUNT> errors {};
+    // Time spent in handlers per dispatched packet, in nanoseconds
+    Histogram::Counts handler_ns {};
+    uint64_t handler_ns_sum {0};
+    // Receive timestamp to dispatch, i.e. time spent in the kernel and the receive queue, for
+    // packets that carry a PacketInfo::rx_time_ns
+    Histogram::Counts receive_to_dispatch_ns {};
+    uint64_t receive_to_dispatch_ns_sum {0};
+
+    StatsSnapshot& operator+=(const StatsSnapshot& other);
+    uint64_t handler_samples() const;
+    // Lower bound of the bucket holding the q-th quantile (0 to 1) of handler_ns
+    uint64_t handler_ns_quantile(double q) const;
+    // Prometheus text exposition format, every metric name starting with `prefix`
+    std::string to_prometheus(const std::string& prefix = "nanoosc") const;
+};
+
+// Counters shared by a client or server and its transport. Every update is a relaxed atomic
+// increment, so the receive thread and the dispatching thread can both record into it. With
+// NANOOSC_STATS set to 0 every update compiles to nothing and snapshots stay zero.
+class Stats
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void count_received(size_t bytes)
+    {
+        add(m_packets_received, 1);
+        add(m_bytes_received, bytes);
+    }
+    void count_sent(size_t packets, size_t bytes)
+    {
+        add(m_packets_sent, packets);
+        add(m_bytes_sent, bytes);
+    }
+    void count_send_failure(bool would_block)
+    {
+        add(m_send_failures, 1);
+        if (would_block) add(m_send_would_block, 1);
+    }
+    void count_dispatched(bool bundle)
+    {
+        add(bundle ? m_bundles_dispatched : m_messages_dispatched, 1);
+    }
+    void count_error(PacketError error)
+    {
+        add(m_errors[static_cast<size_t>(error)], 1);
+    }
+    void count_oversized_drop()
+    {
+        add(m_oversized_drops, 1);
+    }
+    // The socket's running SO_RXQ_OVFL count, so it is stored rather than added
+    void record_kernel_drops(uint64_t total)
+    {
+#if NANOOSC_STATS
+        m_kernel_drops.store(total, std::memory_order_relaxed);
+#else
+        (void)total;
+#endif
+    }
+
+    // Start and stop of a timed handler section; free when stats are compiled out
+    static Clock::time_point start_timer()
+    {
+#if NANOOSC_STATS
+        return Clock::now();
+#else
+        return {};
+#endif
+    }
+    void record_handler_time(Clock::time_point start)
+    {
+#if NANOOSC_STATS
+        m_handler_ns.record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()
+        ));
+#else
+        (void)start;
+#endif
+    }
+    void record_receive_to_dispatch(int64_t rx_time_ns)
+    {
+#if NANOOSC_STATS
+        auto now      = std::chrono::system_clock::now().time_since_epoch();
+        int64_t delay = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count() - rx_time_ns;
+        m_receive_to_dispatch_ns.record(delay > 0 ? static_cast<uint64_t>(delay) : 0);
+#else
+        (void)rx_time_ns;
+#endif
+    }
+
+    StatsSnapshot snapshot() const;
+
+private:
+    static void add(std::atomic<uint64_t>& counter, uint64_t n)
+    {
+#if NANOOSC_STATS
+        counter.fetch_add(n, std::memory_order_relaxed);
+#else
+        (void)counter;
+        (void)n;
+#endif
+    }
+
+    std::atomic<uint64_t> m_packets_received {0};
+    std::atomic<uint64_t> m_bytes_received {0};
+    std::atomic<uint64_t> m_packets_sent {0};
+    std::atomic<uint64_t> m_bytes_sent {0};
+    std::atomic<uint64_t> m_send_failures {0};
+    std::atomic<uint64_t> m_send_would_block {0};
+    std::atomic<uint64_t> m_messages_dispatched {0};
+    std::atomic<uint64_t> m_bundles_dispatched {0};
+    std::atomic<uint64_t> m_kernel_drops {0};
+    std::atomic<uint64_t> m_oversized_drops {0};
+    std::array<std::atomic<uint64_t>, PACKET_ERROR_COUNT> m_errors {};
+    Histogram m_handler_ns;
+    Histogram m_receive_to_dispatch_ns;
+};
+
+// What the transport knows about a received packet besides its bytes
+struct PacketInfo
+{
+    // Receive time in ns since the Unix epoch (CLOCK_REALTIME), 0 if the packet wasn't timestamped
+    int64_t rx_time_ns {0};
+    // Set when rx_time_ns was taken by the NIC rather than the kernel
+    bool hardware_timestamp {false};
+    // IPv4 sender in host byte order, 0 for transports without a notion of one
+    uint32_t source_address {0};
+    uint16_t source_port {0};
+};
+
+// One slot of a batched receive: `data`/`capacity` describe caller-owned storage and `size` is
+// set to the length of the datagram that landed in it.
+struct PacketBuffer
+{
+    uint8_t* data {nullptr};
+    size_t capacity {0};
+    size_t size {0};
+    PacketInfo info;
+};
+
+// One packet of a batched send
+struct Packet
+{
+    const uint8_t* data {nullptr};
+    size_t size {0};
+};
+
+class Transport
+{
+public:
+    Transport()                            = default;
+    Transport(const Transport&)            = delete;
+    Transport(Transport&&)                 = delete;
+    Transport& operator=(const Transport&) = delete;
+    Transport& operator=(Transport&&)      = delete;
+    virtual ~Transport()                   = default;
+
+    virtual bool send(const uint8_t* data, size_t size)         = 0;
+    virtual size_t receive(uint8_t* buffer, size_t buffer_size) = 0;
+    virtual bool is_ready() const                               = 0;
+    virtual void close()                                        = 0;
+
+    // File descriptor that becomes readable when data arrives, for poll/epoll based event loops.
+    // Returns -1 for transports that are not backed by a descriptor.
+    virtual int native_handle() const
+    {
+        return -1;
+    }
+
+    // Receives up to `count` packets without blocking and returns how many were filled. The
+    // default implementation loops over receive(); transports override it to batch syscalls.
+    virtual size_t receive_batch(PacketBuffer* packets, size_t count)
+    {
+        size_t n = 0;
+        while (n < count)
+        {
+            size_t received = receive(packets[n].data, packets[n].capacity);
+            if (received == 0) break;
+            packets[n].info   = PacketInfo {};
+            packets[n++].size = received;
+        }
+        return n;
+    }
+
+    // Sends `count` packets in order and returns how many were accepted. The default
+    // implementation loops over send(); transports override it to batch syscalls.
+    virtual size_t send_batch(const Packet* packets, size_t count)
+    {
+        size_t n = 0;
+        while (n < count && send(packets[n].data, packets[n].size)) ++n;
+        return n;
+    }
+
+    // Zero-copy receive for transports that already hold received packets in their own buffers,
+    // such as stream transports reassembling frames: points up to `count` packets (and their
+    // infos) at that storage, valid until the next receive call on the transport. OSCServer
+    // prefers this over receive_batch() when has_receive_views() is true.
+    virtual size_t receive_views(Packet* packets, PacketInfo* infos, size_t count)
+    {
+        (void)packets;
+        (void)infos;
+        (void)count;
+        return 0;
+    }
+    virtual bool has_receive_views() const
+    {
+        return false;
+    }
+
+    // Blocks until there may be something to receive or `timeout` passes (negative meaning
+    // forever), for transports with no descriptor to poll. OSCServer sleeps here instead of
+    // polling native_handle() when has_wait() is true.
+    virtual void wait_readable(std::chrono::nanoseconds timeout)
+    {
+        (void)timeout;
+    }
+    virtual bool has_wait() const
+    {
+        return false;
+    }
+
+    // Packet, byte and send failure counts are recorded into `stats` from now on. OSCClient and
+    // OSCServer attach their own; pass nullptr to detach.
+    virtual void set_stats(Stats* stats)
+    {
+        m_stats = stats;
+    }
+
+protected:
+    Stats* m_stats {nullptr};
+};
+
+struct UDPTransportOptions
+{
+    // SO_REUSEPORT: lets several server sockets bind the same port, the kernel spreads datagrams
+    // across them by source address
+    bool reuse_port {false};
+    // SO_TIMESTAMPNS: the kernel stamps every datagram on arrival, reported through PacketInfo
+    bool timestamps {false};
+    // SO_TIMESTAMPING with NIC receive stamps, which also needs hardware timestamping switched on
+    // for the interface (SIOCSHWTSTAMP, e.g. hwstamp_ctl). Packets without one get the kernel's.
+    bool hardware_timestamps {false};
+    // IPv4 multicast group to join, e.g. one a FanoutUDPTransport sends to. Several receivers on
+    // one host also need reuse_port.
+    std::string multicast_group;
+    // IPv4 address of the interface to join on, empty to let the kernel choose
+    std::string multicast_interface;
+
+    // The options below apply to client sockets too. Those with a socket option behind them make
+    // setup fail if the kernel refuses it; gso, gro and rxq_overflow quietly fall back instead.
+
+    // SO_RCVBUF / SO_SNDBUF in bytes, 0 for the kernel default. The kernel caps requests at
+    // net.core.rmem_max / wmem_max; force_buffer_sizes uses SO_RCVBUFFORCE / SO_SNDBUFFORCE to go
+    // past that, which needs CAP_NET_ADMIN, and falls back to the capped request without it.
+    int receive_buffer_size {0};
+    int send_buffer_size {0};
+    bool force_buffer_sizes {false};
+    // SO_BUSY_POLL: microseconds to spin on the device queue in blocking receives and poll, 0 off.
+    // Raising it past net.core.busy_read needs CAP_NET_ADMIN.
+    int busy_poll_us {0};
+    // SO_PRIORITY for egress queueing (0 to 6 unprivileged), -1 to leave it
+    int priority {-1};
+    // DSCP codepoint (0 to 63) marked in IP_TOS, e.g. 46 for expedited forwarding; -1 to leave it
+    int dscp {-1};
+    // IP_MTU_DISCOVER mode such as IP_PMTUDISC_DO (set DF, never fragment locally), -1 to leave it
+    int mtu_discover {-1};
+    // SO_INCOMING_CPU: with reuse_port, the kernel prefers the socket whose CPU matches the one
+    // that received the packet, so pin each socket's thread to the CPU given here. -1 to leave it.
+    int incoming_cpu {-1};
+    // UDP_SEGMENT: send_batch() hands runs of equal-sized packets to the kernel as one
+    // super-datagram that is split on the way out (by the NIC where it supports UDP GSO)
+    bool gso {false};
+    // UDP_GRO: the kernel may deliver a burst of equal-sized datagrams from one sender as one
+    // receive; receive_batch() splits it back into packets in order
+    bool gro {false};
+    // SO_RXQ_OVFL: track datagrams the kernel dropped because the receive queue was full, see
+    // UDPTransport::kernel_drops() and StatsSnapshot::kernel_drops
+    bool rxq_overflow {false};
+};
+
+class UDPTransport final : public Transport
+{
+public:
+    UDPTransport(const std::string& host, uint16_t port, const UDPTransportOptions& options = {})
+        : m_socket_fd(-1), m_host(host), m_port(port), m_options(options), m_is_server(false), m_connected(false)
+    {
+        if (!setup_client())
+        {
+            throw std::system_error(errno, std::generic_category(), "UDP client setup failed");
+        }
+    }
+    explicit UDPTransport(uint16_t port, const UDPTransportOptions& options = {})
+        : m_socket_fd(-1), m_port(port), m_options(options), m_is_server(true), m_connected(false)
+    {
+        if (!setup_server())
+        {
+            throw std::system_error(errno, std::generic_category(), "UDP server setup failed");
+        }
+    }
+    UDPTransport(const UDPTransport&)            = delete;
+    UDPTransport& operator=(const UDPTransport&) = delete;
+    UDPTransport(UDPTransport&&)                 = delete;
+    UDPTransport& operator=(UDPTransport&&)      = delete;
+    ~UDPTransport() override
+    {
+        close();
+    }
+
+    bool send(const uint8_t* data, size_t size) override;
+    size_t receive(uint8_t* buffer, size_t buffer_size) override;
+    // Use recvmmsg/sendmmsg on Linux, one syscall per packet elsewhere
+    size_t receive_batch(PacketBuffer* packets, size_t count) override;
+    size_t send_batch(const Packet* packets, size_t count) override;
+    bool is_ready() const override
+    {
+        return m_connected;
+    }
+    void close() override;
+    int native_handle() const override
+    {
+        return m_socket_fd;
+    }
+    // Datagrams the kernel dropped for lack of receive queue space, as of the last packet
+    // received. Needs rxq_overflow; stays 0 until the first drop.
+    uint32_t kernel_drops() const
+    {
+        return m_kernel_drops;
+    }
+    // Whether gso / gro are in effect, i.e. were asked for and the kernel supports them
+    bool uses_gso() const
+    {
+        return m_gso;
+    }
+    bool uses_gro() const
+    {
+        return m_gro;
+    }
+
+private:
+    struct GROSegment
+    {
+        size_t offset;
+        size_t size;
+        PacketInfo info;
+    };
+
+    bool setup_client();
+    bool setup_server();
+    // The options shared by client and server sockets
+    bool apply_options();
+    // Moves segments left over from a split GRO datagram into `packets`
+    size_t take_gro_pending(PacketBuffer* packets, size_t count);
+    // Splits the GRO datagrams among `received` packets in place; those that don't fit in
+    // `count` go to m_gro_pending. Returns the number of packets now filled.
+    size_t split_gro(PacketBuffer* packets, size_t received, size_t count, const uint16_t* segment_sizes);
+
+    int m_socket_fd;
+    std::string m_host;
+    int m_port;
+    UDPTransportOptions m_options;
+    // 0 without receive timestamps, otherwise the SO_ option that enabled them
+    int m_timestamping {0};
+    bool m_gso {false};
+    // Lowered when the kernel refuses segments that big (larger than the path MTU allows)
+    size_t m_gso_size_limit {SIZE_MAX};
+    bool m_gro {false};
+    bool m_rxq_overflow {false};
+    uint32_t m_kernel_drops {0};
+    std::vector<uint8_t> m_gro_bytes;
+    std::vector<GROSegment> m_gro_pending;
+    size_t m_gro_next {0};
+
+    bool m_is_server;
+    bool m_connected;
+};
+
+struct FanoutOptions
+{
+    // Hops multicast destinations may travel, 1 keeps them on the local network
+    int multicast_ttl {1};
+    // Whether multicast sends are also delivered to receivers on this host
+    bool multicast_loop {true};
+    // IPv4 address of the interface multicast goes out on, empty for the routing default
+    std::string multicast_interface;
+    // A destination is skipped for retry_interval once it reports this many errors with no
+    // error-free retry_interval in between. Most errors are ICMP reports that arrive after the send.
+    uint32_t failure_limit {FANOUT_FAILURE_LIMIT};
+    std::chrono::milliseconds retry_interval {FANOUT_RETRY_MS};
+};
+
+struct FanoutDestination
+{
+    std::string host;
+    uint16_t port {0};
+    uint64_t packets_sent {0};
+    uint64_t errors {0};
+    uint32_t consecutive_errors {0};
+    // errno of the last failure: a local send error or an ICMP error reported back for this peer
+    int last_error {0};
+    bool suspended {false};
+};
+
+// Sends every packet to a list of destinations from one unconnected socket, one sendmmsg() per
+// batch with a msghdr per destination. Paired with OSCClient each message is encoded once however
+// many peers there are. Destinations may be unicast or multicast groups. Errors are tracked per
+// destination, including ICMP errors read back from the socket's error queue on Linux, and a
+// failing destination is suspended for a while instead of costing every send.
+class FanoutUDPTransport final : public Transport
+{
+public:
+    explicit FanoutUDPTransport(const FanoutOptions& options = {});
+    FanoutUDPTransport(const FanoutUDPTransport&)            = delete;
+    FanoutUDPTransport& operator=(const FanoutUDPTransport&) = delete;
+    FanoutUDPTransport(FanoutUDPTransport&&)                 = delete;
+    FanoutUDPTransport& operator=(FanoutUDPTransport&&)      = delete;
+    ~FanoutUDPTransport() override
+    {
+        close();
+    }
+
+    // `host` must be an IPv4 address. Returns false if it isn't or the destination is already listed.
+    bool add_destination(const std::string& host, uint16_t port);
+    bool remove_destination(const std::string& host, uint16_t port);
+    size_t destination_count() const
+    {
+        return m_destinations.size();
+    }
+    std::vector<FanoutDestination> destinations() const;
+
+    // True if at least one destination accepted the packet; see destinations() for the rest
+    bool send(const uint8_t* data, size_t size) override;
+    // Returns how many packets, in order, reached at least one destination
+    size_t send_batch(const Packet* packets, size_t count) override;
+    // Replies from any destination
+    size_t receive(uint8_t* buffer, size_t buffer_size) override;
+    bool is_ready() const override
+    {
+        return m_socket_fd >= 0;
+    }
+    void close() override;
+    int native_handle() const override
+    {
+        return m_socket_fd;
+    }
+
+private:
+    struct Destination
+    {
+        FanoutDestination status;
+        // Host byte order
+        uint32_t address;
+        std::chrono::steady_clock::time_point retry_at;
+        std::chrono::steady_clock::time_point last_error_at;
+    };
+
+    Destination* find(uint32_t address, uint16_t port);
+    void record_error(Destination& destination, int error);
+    // Attributes queued ICMP errors to their destinations
+    void drain_errors();
+
+    int m_socket_fd {-1};
+    FanoutOptions m_options;
+    std::vector<Destination> m_destinations;
+    // Destinations taking part in the current send_batch(), as indices into m_destinations
+    std::vector<size_t> m_active;
+    std::vector<uint8_t> m_accepted;
+};
+
+struct IoUringOptions
+{
+    // Receive buffers handed to the kernel through the provided buffer ring, rounded up to a power
+    // of two (at most 32768)
+    size_t buffer_count {IO_URING_BUFFER_COUNT};
+    // Bytes per buffer. Each holds the recvmsg header, source address and control data ahead of
+    // the datagram, so the largest datagram is somewhat smaller; longer ones are dropped.
+    size_t buffer_size {IO_URING_BUFFER_SIZE};
+};
+
+// UDP server receiving through io_uring on Linux: one multishot recvmsg stays armed on the
+// socket and the kernel writes datagrams straight into library-owned buffers from a provided
+// buffer ring. Receiving is then a matter of reading the completion queue, with no syscall per
+// batch, and OSCServer decodes packets where they landed. Sends go through the UDPTransport
+// path. Where io_uring or multishot receive isn't available (older kernels, seccomp, other
+// platforms) it behaves exactly like UDPTransport, see uses_io_uring(). So it does with `gro`
+// set, since GRO datagrams are split by UDPTransport's receive path.
+class IoUringUDPTransport final : public Transport
+{
+public:
+    explicit IoUringUDPTransport(
+        uint16_t port, const UDPTransportOptions& options = {}, const IoUringOptions& uring = {}
+    );
+    IoUringUDPTransport(const IoUringUDPTransport&)            = delete;
+    IoUringUDPTransport& operator=(const IoUringUDPTransport&) = delete;
+    IoUringUDPTransport(IoUringUDPTransport&&)                 = delete;
+    IoUringUDPTransport& operator=(IoUringUDPTransport&&)      = delete;
+    ~IoUringUDPTransport() override;
+
+    bool send(const uint8_t* data, size_t size) override
+    {
+        return m_udp.send(data, size);
+    }
+    size_t send_batch(const Packet* packets, size_t count) override
+    {
+        return m_udp.send_batch(packets, count);
+    }
+    size_t receive(uint8_t* buffer, size_t buffer_size) override;
+    size_t receive_batch(PacketBuffer* packets, size_t count) override;
+    // Points straight into the ring's buffers, which go back to the kernel on the next receive
+    size_t receive_views(Packet* packets, PacketInfo* infos, size_t count) override;
+    bool has_receive_views() const override
+    {
+        return m_ring != nullptr;
+    }
+    bool is_ready() const override
+    {
+        return m_udp.is_ready();
+    }
+    void close() override;
+    // The io_uring descriptor, readable while completions are waiting, or the socket without it
+    int native_handle() const override;
+    void set_stats(Stats* stats) override
+    {
+        m_stats = stats;
+        m_udp.set_stats(stats);
+    }
+    bool uses_io_uring() const
+    {
+        return m_ring != nullptr;
+    }
+    int socket_handle() const
+    {
+        return m_udp.native_handle();
+    }
+    // See UDPTransport::kernel_drops()
+    uint32_t kernel_drops() const
+    {
+        return std::max(m_kernel_drops, m_udp.kernel_drops());
+    }
+
+private:
+    struct Ring;
+
+    // Queues the multishot recvmsg; returns false if the kernel rejected it
+    bool arm();
+    // Gives the buffers handed out by the previous receive_views() back to the kernel
+    void recycle();
+
+    UDPTransport m_udp;
+    bool m_control {false};
+    uint32_t m_kernel_drops {0};
+    std::unique_ptr<Ring> m_ring;
+};
+
+// How packets are delimited on a stream: OSC 1.0 puts a 32-bit big-endian size in front of each
+// packet, OSC 1.1 uses SLIP (RFC 1055) with an END byte on both sides of each packet.
+enum class TCPFraming
+{
+    SizePrefix,
+    SLIP,
+};
+
+// Incremental frame parser for a byte stream. Reads go straight into its growable buffer, any
+// number of frames can complete per read, and frames are yielded in place: SLIP escapes are
+// undone within the buffer, so no frame is ever copied.
+class FrameParser
+{
+public:
+    static constexpr uint8_t SLIP_END     = 0xC0;
+    static constexpr uint8_t SLIP_ESC     = 0xDB;
+    static constexpr uint8_t SLIP_ESC_END = 0xDC;
+    static constexpr uint8_t SLIP_ESC_ESC = 0xDD;
+
+    explicit FrameParser(TCPFraming framing, size_t max_frame_size = TCP_MAX_FRAME_SIZE)
+        : m_framing(framing), m_max_frame_size(max_frame_size)
+    {}
+
+    // Room for at least `min_free` more bytes, growing the buffer if the frame in progress needs
+    // it. Invalidates frames returned by next(). `available` is set to the usable size.
+    uint8_t* write_area(size_t min_free, size_t& available);
+    // Marks `n` bytes written at write_area() as received
+    void commit(size_t n);
+    // Points `frame` at the next complete frame. Returns false when more data is needed or the
+    // stream is corrupt, see failed().
+    bool next(Packet& frame);
+    // A size prefix above max_frame_size or a SLIP frame that outgrew it; the stream can't be resynced
+    bool failed() const
+    {
+        return m_failed;
+    }
+    bool empty() const
+    {
+        return m_begin == m_end;
+    }
+    void reset();
+
+    // Appends `data` framed for the wire to `out`
+    static void encode_slip(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+
+private:
+    TCPFraming m_framing;
+    size_t m_max_frame_size;
+    std::vector<uint8_t> m_buffer;
+    // [m_begin, m_end) is unconsumed input. For SLIP the current frame's decoded bytes are
+    // [m_begin, m_out) and decoding resumes at m_scan.
+    size_t m_begin {0};
+    size_t m_end {0};
+    size_t m_out {0};
+    size_t m_scan {0};
+    bool m_failed {false};
+};
+
+// OSC over TCP. As a client it connects to host:port; as a server it accepts any number of peers,
+// receives from all of them and sends every packet to each. Packets may be as large as
+// max_frame_size and are handed to OSCServer straight out of the receive buffer.
+class TCPTransport final : public Transport
+{
+public:
+    TCPTransport(
+        const std::string& host, uint16_t port, TCPFraming framing = TCPFraming::SizePrefix,
+        size_t max_frame_size = TCP_MAX_FRAME_SIZE
+    );
+    explicit TCPTransport(
+        uint16_t port, TCPFraming framing = TCPFraming::SizePrefix, size_t max_frame_size = TCP_MAX_FRAME_SIZE
+    );
+    TCPTransport(const TCPTransport&)            = delete;
+    TCPTransport& operator=(const TCPTransport&) = delete;
+    TCPTransport(TCPTransport&&)                 = delete;
+    TCPTransport& operator=(TCPTransport&&)      = delete;
+    ~TCPTransport() override
+    {
+        close();
+    }
+
+    // As a client, blocks for up to TCP_SEND_TIMEOUT_MS while the peer applies backpressure. As a
+    // server, never blocks: what a slow peer's socket won't take is queued and flushed as it
+    // drains, on the next send or receive, and a peer whose queue would pass
+    // TCP_SEND_QUEUE_LIMIT is disconnected. A peer that fails mid-frame is disconnected too,
+    // since its stream can no longer be framed.
+    bool send(const uint8_t* data, size_t size) override;
+    // Copies the next frame into `buffer`; frames that don't fit are dropped and counted in
+    // StatsSnapshot::oversized_drops
+    size_t receive(uint8_t* buffer, size_t buffer_size) override;
+    size_t receive_batch(PacketBuffer* packets, size_t count) override;
+    size_t receive_views(Packet* packets, PacketInfo* infos, size_t count) override;
+    bool has_receive_views() const override
+    {
+        return true;
+    }
+    // One writev() for the whole batch
+    size_t send_batch(const Packet* packets, size_t count) override;
+    bool is_ready() const override
+    {
+        return m_is_server ? m_listen_fd >= 0 : !m_peers.empty();
+    }
+    void close() override;
+    // The connected socket for clients. Servers return an epoll descriptor covering the listening
+    // socket and every peer on Linux, and -1 elsewhere.
+    int native_handle() const override
+    {
+        return m_is_server ? m_poll_fd : (m_peers.empty() ? -1 : m_peers.front()->fd);
+    }
+    size_t peer_count() const
+    {
+        return m_peers.size();
+    }
+
+private:
+    struct Peer
+    {
+        Peer(int fd, TCPFraming framing, size_t max_frame_size) : fd(fd), parser(framing, max_frame_size)
+        {}
+
+        int fd;  // -1 once closed, reaped at the start of the next receive
+        FrameParser parser;
+        PacketInfo info;
+        // Server side output the socket hasn't taken yet, starting at pending_offset
+        std::vector<uint8_t> pending;
+        size_t pending_offset {0};
+    };
+
+    void accept_peers();
+    void add_peer(int fd, uint32_t address, uint16_t port);
+    void drop_peer(size_t index);
+    void close_peer(Peer& peer);
+    // Writes every segment with writev(), waiting out EAGAIN for up to TCP_SEND_TIMEOUT_MS.
+    // `would_block` is set when a failure was the peer's backpressure rather than a socket error.
+    bool write_all(int fd, const Packet* segments, size_t count, bool& would_block);
+    // Server side: writes what the socket takes now and queues the rest, false if the peer failed
+    bool write_queued(Peer& peer, const Packet* segments, size_t count, size_t bytes, bool& would_block);
+    bool flush_pending(Peer& peer);
+    void watch_writable(Peer& peer, bool writable);
+    bool send_frames(const Packet* packets, size_t count);
+
+    TCPFraming m_framing;
+    size_t m_max_frame_size;
+    bool m_is_server;
+    int m_listen_fd {-1};
+    int m_poll_fd {-1};
+    std::vector<std::unique_ptr<Peer>> m_peers;
+    // Where the next receive resumes, so busy peers can't starve the others
+    size_t m_next_peer {0};
+    std::vector<uint8_t> m_send_buffer;
+    std::vector<Packet> m_segments;
+};
+
+enum class SharedMemoryRole
+{
+    // Creates the ring and receives from it, the OSCServer side
+    Receiver,
+    // Opens an existing ring and sends into it, the OSCClient side. Any number may share one ring.
+    Sender,
+};
+
+enum class SharedMemoryWakeup
+{
+    // A sleeping receiver is woken through a futex in the shared segment. Senders only make the
+    // syscall while the receiver is actually asleep. Falls back to Poll off Linux.
+    Futex,
+    // The receiver spins (yielding) until a packet arrives or the timeout passes. Senders never
+    // make a syscall, for latency-critical receivers that can dedicate a core.
+    Poll,
+};
+
+struct SharedMemoryOptions
+{
+    // Slots in the ring, rounded up to a power of two. Set by the receiver, senders use its layout.
+    size_t capacity {SHARED_MEMORY_CAPACITY};
+    // Largest packet a slot holds; sends of bigger packets fail
+    size_t slot_size {SHARED_MEMORY_SLOT_SIZE};
+    SharedMemoryWakeup wakeup {SharedMemoryWakeup::Futex};
+};
+
+// Same-host OSC through a POSIX shared memory ring (shm_open `name`), skipping the network stack.
+// Senders claim slots lock-free and copy the packet in once; the receiver hands slots to OSCServer
+// without copying and frees them on the next receive. The receiver recreates the segment on
+// construction and unlinks it on destruction, so senders must be opened after it. A sender that
+// dies between claiming and publishing a slot stalls the ring.
+class SharedMemoryTransport final : public Transport
+{
+public:
+    SharedMemoryTransport(const std::string& name, SharedMemoryRole role, const SharedMemoryOptions& options = {});
+    SharedMemoryTransport(const SharedMemoryTransport&)            = delete;
+    SharedMemoryTransport& operator=(const SharedMemoryTransport&) = delete;
+    SharedMemoryTransport(SharedMemoryTransport&&)                 = delete;
+    SharedMemoryTransport& operator=(SharedMemoryTransport&&)      = delete;
+    ~SharedMemoryTransport() override
+    {
+        close();
+    }
+
+    // Fails without blocking when the ring is full. Receivers can't send.
+    bool send(const uint8_t* data, size_t size) override;
+    // Wakes the receiver once for the whole batch
+    size_t send_batch(const Packet* packets, size_t count) override;
+    size_t receive(uint8_t* buffer, size_t buffer_size) override;
+    size_t receive_batch(PacketBuffer* packets, size_t count) override;
+    size_t receive_views(Packet* packets, PacketInfo* infos, size_t count) override;
+    bool has_receive_views() const override
+    {
+        return true;
+    }
+    void wait_readable(std::chrono::nanoseconds timeout) override;
+    bool has_wait() const override
+    {
+        return true;
+    }
+    bool is_ready() const override
+    {
+        return m_layout != nullptr;
+    }
+    void close() override;
+    // There is no descriptor; OSCServer waits through wait_readable()
+    int native_handle() const override
+    {
+        return -1;
+    }
+    size_t capacity() const
+    {
+        return m_capacity;
+    }
+    size_t slot_size() const
+    {
+        return m_slot_size;
+    }
+
+private:
+    struct Layout;
+
+    uint8_t* slot(uint64_t position) const;
+    bool push(const uint8_t* data, size_t size);
+    // Publishes to a receiver that is asleep
+    void wake();
+    // Frees the slots handed out by the previous receive_views()
+    void release_views();
+
+    std::string m_name;
+    SharedMemoryRole m_role;
+    SharedMemoryWakeup m_wakeup;
+    Layout* m_layout {nullptr};
+    size_t m_map_size {0};
+    size_t m_capacity {0};
+    size_t m_slot_size {0};
+    size_t m_slot_stride {0};
+    // Receiver only: next slot to read and how many slots from there are out as views
+    uint64_t m_read {0};
+    size_t m_held {0};
+};
+
+// Capture files are a 16 byte header ("NOSCCAP\0", u32 version, u32 reserved) followed by one
+// record per packet: u32 size, u64 receive time in ns since the Unix epoch, u32 IPv4 source,
+// u16 source port, u16 flags (bit 0: hardware timestamp), then the raw packet bytes. Integers
+// are big-endian like the rest of OSC. Files are only ever appended to.
+struct CaptureRecord
+{
+    const uint8_t* data {nullptr};
+    size_t size {0};
+    PacketInfo info;
+};
+
+// Appends packets to a capture file, buffering up to CAPTURE_BUFFER_SIZE bytes between writes.
+// Not thread-safe; give each receiving thread its own writer.
+class CaptureWriter
+{
+public:
+    // Creates `path` or appends to an existing capture, first cutting it back to its last complete
+    // record so a writer that died mid-append doesn't leave a torn record in the middle. Throws
+    // std::system_error if it can't be opened and std::runtime_error if it holds something other
+    // than a capture.
+    explicit CaptureWriter(const std::string& path);
+    CaptureWriter(const CaptureWriter&)            = delete;
+    CaptureWriter& operator=(const CaptureWriter&) = delete;
+    ~CaptureWriter();
+
+    // Packets without a receive timestamp are stamped with the current time, so replay can pace them
+    void write(const uint8_t* data, size_t size, const PacketInfo& info = {});
+    // Writes out buffered records, throws std::system_error on failure
+    void flush();
+    uint64_t records() const
+    {
+        return m_records;
+    }
+
+private:
+    int m_fd {-1};
+    std::vector<uint8_t> m_buffer;
+    uint64_t m_records {0};
+};
+
+// Reads a capture file through a read-only mapping, so records are handed out without copying
+class CaptureReader
+{
+public:
+    // Throws std::system_error if `path` can't be mapped and std::runtime_error if it isn't a capture
+    explicit CaptureReader(const std::string& path);
+    CaptureReader(const CaptureReader&)            = delete;
+    CaptureReader& operator=(const CaptureReader&) = delete;
+    ~CaptureReader();
+
+    // Points `out` at the next record, valid for the reader's lifetime. Returns false at the end,
+    // which includes a last record cut short by a writer that died mid-append.
+    bool next(CaptureRecord& out);
+    void rewind();
+
+    // Sends the remaining records through `transport`, paced by their receive times divided by
+    // `speed`: 1 replays in real time, 2 twice as fast and 0 as fast as possible, in batches of
+    // RECEIVE_BATCH_SIZE. Returns the number of packets the transport accepted.
+    size_t replay(Transport& transport, double speed = 1.0);
+
+private:
+    const uint8_t* m_data {nullptr};
+    size_t m_size {0};
+    size_t m_offset {0};
+};
+
+class OSCClient
+{
+public:
+    explicit OSCClient(std::unique_ptr<Transport> transport) : m_transport(std::move(transport)), m_buffer(BUFFER_MAX_SIZE)
+    {
+        if (m_transport) m_transport->set_stats(&m_stats);
+    }
+    ~OSCClient()
+    {
+        if (m_transport) flush();
+    }
+
+    bool send_message(const Message& msg);
+    bool send_message(const CompactMessage& msg);
+    bool send_bundle(const Bundle& bundle);
+    bool send_packet(const uint8_t* data, size_t size);
+
+    // Queue mode: packets are encoded back to back into m_buffer and handed to the transport as
+    // one send_batch() on flush(), or as soon as either threshold is reached.
+    void enable_queue(size_t max_packets = SEND_QUEUE_MAX_PACKETS, size_t max_bytes = BUFFER_MAX_SIZE);
+    // Flushes anything pending and returns to one send per packet
+    void disable_queue();
+    // Returns false if the transport did not accept every queued packet; they are dropped either way
+    bool flush();
+    size_t queued() const
+    {
+        return m_queue.size();
+    }
+
+    // Coalescing mode: each packet is encoded straight into an open immediate bundle, which is
+    // sent once the next packet would take it past `mtu` bytes, once `max_delay` has passed since
+    // its first packet (checked on every send and by flush_if_due(); zero means no deadline), or
+    // on flush(). A bundle of one is sent as that packet alone, and packets too big to share a
+    // bundle go out unbundled, in order. Combines with queue mode, which then batches the bundles.
+    // Receivers get bundles, so OSCServer needs a bundle handler or an AddressSpace to see them.
+    void enable_coalescing(
+        size_t mtu = COALESCE_MTU, std::chrono::microseconds max_delay = std::chrono::microseconds(COALESCE_MAX_DELAY_US)
+    );
+    // Sends the open bundle and returns to one packet per send
+    void disable_coalescing();
+    // Sends the open bundle if its deadline has passed, for event loops to call when idle.
+    // Returns false only if that send failed.
+    bool flush_if_due();
+    // When the open bundle is due, time_point::max() if nothing is waiting
+    std::chrono::steady_clock::time_point coalesce_deadline() const
+    {
+        return m_coalesce_count > 0 && m_coalesce_delay.count() > 0 ? m_coalesce_deadline
+                                                                    : std::chrono::steady_clock::time_point::max();
+    }
+
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+    // The transport's descriptor, for waiting until it is writable again
+    int native_handle() const
+    {
+        return m_transport ? m_transport->native_handle() : -1;
+    }
+
+private:
+    // `encode(dst, cap)` writes the packet and returns its size or 0; `encoded_size()` is only
+    // asked for when the packet doesn't fit the scratch buffer
+    template <typename Encoder, typename Sizer>
+    bool send_encoded(Encoder&& encode, Sizer&& encoded_size);
+    // send_encoded() minus coalescing: straight to the transport or the queue
+    template <typename Encoder, typename Sizer>
+    bool send_uncoalesced(Encoder&& encode, Sizer&& encoded_size);
+    // Sends the open bundle, if any
+    bool send_coalesced();
+
+    Stats m_stats;
+    std::unique_ptr<Transport> m_transport;
+    std::vector<uint8_t> m_buffer;
+
+    std::vector<Packet> m_queue;
+    size_t m_queue_bytes {0};
+    size_t m_queue_max_packets {0};
+    size_t m_queue_max_bytes {0};
+
+    // The open bundle: header at the front, then [size][packet] elements up to m_coalesce_size
+    std::vector<uint8_t> m_coalesce;
+    size_t m_coalesce_mtu {0};
+    size_t m_coalesce_size {0};
+    size_t m_coalesce_count {0};
+    std::chrono::microseconds m_coalesce_delay {0};
+    std::chrono::steady_clock::time_point m_coalesce_deadline;
+};
+
+// Routes messages to handlers registered per OSC address. Registered addresses live in a trie
+// keyed by path segment and incoming addresses may be OSC patterns. Every distinct incoming
+// address is resolved once and cached, so repeat traffic is a single hash lookup.
+class AddressSpace
+{
+public:
+    using Handler = std::function<void(const MessageView&)>;
+
+    static constexpr size_t CACHE_MAX_SIZE = 4096;
+
+    AddressSpace() : m_root(std::make_unique<Node>())
+    {}
+
+    // Registers (or replaces) the handler for a literal address such as "/mixer/ch/gain". Methods
+    // must not be added or removed from inside a handler.
+    void add_method(const std::string& address, Handler handler);
+    bool remove_method(const std::string& address);
+    void clear();
+
+    // Calls every handler whose address matches msg.address and returns how many were called
+    size_t dispatch(const MessageView& msg);
+    // Dispatches every message in the bundle, descending into nested bundles. Addresses are
+    // matched before a message is decoded, so unrouted messages cost only the address lookup,
+    // and elements of a lazily decoded bundle that turn out malformed, or nested deeper than
+    // BUNDLE_MAX_DEPTH, are skipped.
+    size_t dispatch(const BundleView& bundle);
+
+private:
+    struct Node
+    {
+        std::unordered_map<std::string, std::unique_ptr<Node>> children;
+        Handler handler;
+    };
+
+    struct CacheEntry
+    {
+        std::string address;
+        std::vector<const Node*> methods;
+    };
+
+    size_t dispatch(const BundleView& bundle, int depth);
+    const std::vector<const Node*>& resolve(std::string_view address);
+    void collect(const Node& node, std::string_view address, std::vector<const Node*>& out) const;
+
+    std::unique_ptr<Node> m_root;
+    // Keys view into CacheEntry::address, which stays put because entries are heap allocated
+    std::unordered_map<std::string_view, std::unique_ptr<CacheEntry>> m_cache;
+};
+
+// Holds bundle packets until their timetag comes due. Pending bundles sit in a binary min-heap
+// ordered by timetag (ties keep arrival order) and their bytes in recycled slots, so once warm
+// scheduling does not allocate.
+class BundleScheduler
+{
+public:
+    explicit BundleScheduler(size_t max_pending = SCHEDULER_MAX_PENDING) : m_max_pending(max_pending)
+    {
+        m_heap.reserve(max_pending);
+    }
+
+    // Copies the packet and returns false if max_pending bundles are already waiting
+    bool schedule(OSCTimeTag time, const uint8_t* data, size_t size)
+    {
+        if (m_heap.size() >= m_max_pending) return false;
+        size_t slot = 0;
+        if (m_free.empty())
+        {
+            slot = m_slots.size();
+            m_slots.emplace_back();
+        }
+        else
+        {
+            slot = m_free.back();
+            m_free.pop_back();
+        }
+        m_slots[slot].assign(data, data + size);
+        m_heap.push_back({time, m_seq++, slot});
+        std::push_heap(m_heap.begin(), m_heap.end(), later);
+        return true;
+    }
+
+    // Calls fn(data, size) for every bundle due at or before `now`, earliest first. fn must not throw.
+    template <typename Fn>
+    size_t run_due(OSCTimeTag now, Fn&& fn)
+    {
+        size_t count = 0;
+        while (!m_heap.empty() && m_heap.front().time <= now)
+        {
+            std::pop_heap(m_heap.begin(), m_heap.end(), later);
+            size_t slot = m_heap.back().slot;
+            m_heap.pop_back();
+            fn(m_slots[slot].data(), m_slots[slot].size());
+            m_free.push_back(slot);
+            ++count;
+        }
+        return count;
+    }
+
+    bool empty() const
+    {
+        return m_heap.empty();
+    }
+    size_t size() const
+    {
+        return m_heap.size();
+    }
+    // Timetag of the earliest pending bundle, only meaningful when not empty()
+    OSCTimeTag next_due() const
+    {
+        return m_heap.front().time;
+    }
+    void clear()
+    {
+        for (const auto& entry : m_heap) m_free.push_back(entry.slot);
+        m_heap.clear();
+    }
+
+private:
+    struct Entry
+    {
+        OSCTimeTag time;
+        uint64_t seq;
+        size_t slot;
+    };
+
+    static bool later(const Entry& a, const Entry& b)
+    {
+        return a.time != b.time ? a.time > b.time : a.seq > b.seq;
+    }
+
+    size_t m_max_pending;
+    uint64_t m_seq {0};
+    std::vector<Entry> m_heap;
+    std::vector<std::vector<uint8_t>> m_slots;
+    std::vector<size_t> m_free;
+};
+
+struct ValueCoalescerOptions
+{
+    // Distinct keys held per drain, further keys are dispatched without coalescing
+    size_t capacity {VALUE_COALESCE_CAPACITY};
+    // Key on the type tag signature as well as the address, so "/xy ,ff" and "/xy ,i" are kept apart
+    bool key_by_tags {false};
+    // Applies to addresses no rule matches
+    bool coalesce_by_default {false};
+};
+
+// Last-value-wins merging for parameter streams. Messages offered between two drains are kept in
+// a fixed-size open-addressing table keyed by address (and optionally type tags), each new value
+// replacing the stale one in place; drain() then hands over one message per key, in the order the
+// keys were first seen. Slots keep their storage, so once warm coalescing does not allocate.
+class ValueCoalescer
+{
+public:
+    explicit ValueCoalescer(const ValueCoalescerOptions& options = {});
+
+    // Rules are checked in the order added and the first whose pattern matches the address
+    // decides, so trigger-style addresses can be excluded with `coalesce` false ahead of a
+    // broader rule. Throws std::invalid_argument if the pattern does not start with '/'.
+    void add_rule(const std::string& pattern, bool coalesce);
+
+    // Copies the message and returns true if it is to be coalesced. Returns false, leaving the
+    // message to the caller, for bundles, malformed packets, addresses the rules exclude and new
+    // keys arriving while the table is full.
+    bool offer(const uint8_t* data, size_t size, const PacketInfo& info = {});
+
+    // Calls fn(data, size, info) with the newest message of every pending key and empties the table
+    template <typename Fn>
+    size_t drain(Fn&& fn)
+    {
+        size_t count = m_dirty.size();
+        for (uint32_t index : m_dirty)
+        {
+            Slot& slot = m_slots[index];
+            slot.used  = false;
+            fn(slot.data.data(), slot.data.size(), slot.info);
+        }
+        m_dirty.clear();
+        return count;
+    }
+
+    size_t pending() const
+    {
+        return m_dirty.size();
+    }
+    // Stale values replaced by a newer one before they were drained
+    uint64_t merged() const
+    {
+        return m_merged;
+    }
+
+private:
+    struct Slot
+    {
+        bool used {false};
+        uint32_t hash {0};
+        std::string key;
+        std::vector<uint8_t> data;
+        PacketInfo info;
+    };
+
+    bool should_coalesce(std::string_view address) const;
+
+    ValueCoalescerOptions m_options;
+    std::vector<std::pair<std::string, bool>> m_rules;
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_dirty;
+    std::string m_key;
+    uint64_t m_merged {0};
+};
+
+enum class OverflowPolicy
+{
+    DropNewest,
+    DropOldest
+};
+
+// Lock-free single-producer/single-consumer ring of raw packets with fixed-size slots. Each slot
+// carries a sequence number (Vyukov style) that says whether it is free or filled, which lets the
+// producer reclaim the oldest unread slot under OverflowPolicy::DropOldest without locking.
+class PacketRing
+{
+public:
+    // capacity is rounded up to a power of two, packets larger than slot_size are dropped
+    PacketRing(size_t capacity, size_t slot_size, OverflowPolicy policy)
+        : m_slot_size(slot_size), m_policy(policy)
+    {
+        size_t n = 1;
+        while (n < capacity) n <<= 1;
+        m_mask  = n - 1;
+        m_slots = std::make_unique<Slot[]>(n);
+        m_data.resize(n * slot_size);
+        for (size_t i = 0; i < n; ++i) m_slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    // Producer side. Returns false if the packet was dropped.
+    bool push(const uint8_t* data, size_t size, const PacketInfo& info = {})
+    {
+        if (size > m_slot_size)
+        {
+            m_oversized.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        uint64_t w = m_write.load(std::memory_order_relaxed);
+        Slot& slot = m_slots[w & m_mask];
+        if (slot.seq.load(std::memory_order_acquire) != w)
+        {
+            // Full. Reclaiming the oldest packet only works if the consumer is not reading it right now.
+            m_overflows.fetch_add(1, std::memory_order_relaxed);
+            if (m_policy == OverflowPolicy::DropNewest) return false;
+            uint64_t oldest = w - capacity();
+            if (!m_read.compare_exchange_strong(oldest, oldest + 1, std::memory_order_acq_rel) &&
+                slot.seq.load(std::memory_order_acquire) != w)
+            {
+                return false;
+            }
+        }
+        std::memcpy(m_data.data() + (w & m_mask) * m_slot_size, data, size);
+        slot.size = size;
+        slot.info = info;
+        slot.seq.store(w + 1, std::memory_order_release);
+        m_write.store(w + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Calls fn(data, size) or fn(data, size, info) on the oldest packet in place and
+    // returns false if empty.
+    template <typename Fn>
+    bool pop(Fn&& fn)
+    {
+        for (;;)
+        {
+            uint64_t r = m_read.load(std::memory_order_acquire);
+            Slot& slot = m_slots[r & m_mask];
+            if (slot.seq.load(std::memory_order_acquire) != r + 1) return false;
+            // Claim the slot, the producer may just have reclaimed it under DropOldest
+            if (!m_read.compare_exchange_strong(r, r + 1, std::memory_order_acq_rel)) continue;
+            if constexpr (std::is_invocable_v<Fn, const uint8_t*, size_t, const PacketInfo&>)
+            {
+                fn(m_data.data() + (r & m_mask) * m_slot_size, slot.size, slot.info);
+            }
+            else
+            {
+                fn(m_data.data() + (r & m_mask) * m_slot_size, slot.size);
+            }
+            slot.seq.store(r + capacity(), std::memory_order_release);
+            return true;
+        }
+    }
+
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+    size_t depth() const
+    {
+        uint64_t w = m_write.load(std::memory_order_acquire);
+        uint64_t r = m_read.load(std::memory_order_acquire);
+        return w > r ? static_cast<size_t>(w - r) : 0;
+    }
+    // Packets dropped because the ring was full, and because they did not fit in a slot
+    uint64_t overflows() const
+    {
+        return m_overflows.load(std::memory_order_relaxed);
+    }
+    uint64_t oversized() const
+    {
+        return m_oversized.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Slot
+    {
+        std::atomic<uint64_t> seq {0};
+        size_t size {0};
+        PacketInfo info;
+    };
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> m_write {0};
+    std::atomic<uint64_t> m_overflows {0};
+    std::atomic<uint64_t> m_oversized {0};
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> m_read {0};
+    alignas(CACHE_LINE_SIZE) size_t m_mask {0};
+    size_t m_slot_size;
+    OverflowPolicy m_policy;
+    std::unique_ptr<Slot[]> m_slots;
+    std::vector<uint8_t> m_data;
+};
+
+// Receive time minus bundle timetag for one sender, over every timestamped bundle it sent that
+// wasn't TIMETAG_IMMEDIATE. When the sender stamps bundles with their send time, min_offset_ns is
+// its clock skew plus the fastest transit and the spread above it is network and kernel jitter;
+// Stats::receive_to_dispatch_ns then covers kernel to handler and Stats::handler_ns the handlers.
+struct SourceTiming
+{
+    uint32_t address {0};
+    uint16_t port {0};
+    uint64_t samples {0};
+    int64_t last_offset_ns {0};
+    int64_t min_offset_ns {0};
+    int64_t max_offset_ns {0};
+    double mean_offset_ns {0.0};
+
+    int64_t jitter_ns() const
+    {
+        return last_offset_ns - min_offset_ns;
+    }
+};
+
+class OSCServer
+{
+public:
+    explicit OSCServer(std::unique_ptr<Transport> transport)
+        : m_transport(std::move(transport)), m_buffer(BUFFER_MAX_SIZE * RECEIVE_BATCH_SIZE), m_batch(RECEIVE_BATCH_SIZE)
+    {
+        if (m_transport) m_transport->set_stats(&m_stats);
+        for (size_t i = 0; i < m_batch.size(); ++i)
+        {
+            m_batch[i].data     = m_buffer.data() + i * BUFFER_MAX_SIZE;
+            m_batch[i].capacity = BUFFER_MAX_SIZE;
+        }
+    }
+    // Not movable: the transport records into the server's Stats and the receive thread runs on
+    // the server itself. Hold it in a std::unique_ptr to hand it around.
+    OSCServer(const OSCServer&)            = delete;
+    OSCServer& operator=(const OSCServer&) = delete;
+    OSCServer(OSCServer&&)                 = delete;
+    OSCServer& operator=(OSCServer&&)      = delete;
+    ~OSCServer()
+    {
+        stop_receive_thread();
+    }
+
+    using MessageHandler     = std::function<void(const Message&)>;
+    using BundleHandler      = std::function<void(const Bundle&)>;
+    using MessageViewHandler = std::function<void(const MessageView&)>;
+    using BundleViewHandler  = std::function<void(const BundleView&)>;
+
+    void set_message_handler(MessageHandler handler)
+    {
+        m_msg_handler = handler;
+    }
+
+    void set_bundle_handler(BundleHandler handler)
+    {
+        m_bundle_handler = handler;
+    }
+
+    // View handlers decode straight out of the receive buffer without allocating. They may be
+    // combined with the owning handlers above, in which case both are called.
+    void set_message_view_handler(MessageViewHandler handler)
+    {
+        m_msg_view_handler = handler;
+    }
+
+    void set_bundle_view_handler(BundleViewHandler handler)
+    {
+        m_bundle_view_handler = handler;
+    }
+
+    // Routes every received message, including those inside bundles, through `space`. The address
+    // space is not owned and must outlive the server; pass nullptr to detach it.
+    void set_address_space(AddressSpace* space)
+    {
+        m_address_space = space;
+    }
+
+    // Hand bundles to the view handler and the AddressSpace decoded with
+    // BundleView::try_decode_lazy(), so elements nobody looks at are never validated. The view
+    // handler must then access elements through try_message()/try_bundle(). Malformed elements
+    // are skipped by the AddressSpace rather than rejecting the whole bundle.
+    void set_lazy_bundles(bool lazy)
+    {
+        m_lazy_bundles = lazy;
+    }
+
+    // Honour bundle timetags: bundles stamped in the future are held back and dispatched by the
+    // process_* calls once due. TIMETAG_IMMEDIATE and past timetags still dispatch on arrival, as
+    // does anything that arrives while max_pending bundles are already waiting.
+    void enable_scheduler(size_t max_pending = SCHEDULER_MAX_PENDING)
+    {
+        m_scheduler = std::make_unique<BundleScheduler>(max_pending);
+    }
+    // Drops any bundles still pending
+    void disable_scheduler()
+    {
+        m_scheduler.reset();
+    }
+    size_t pending_bundles() const
+    {
+        return m_scheduler ? m_scheduler->size() : 0;
+    }
+
+    // Last-value-wins delivery for parameter streams: while a process_* call drains the transport,
+    // messages the coalescer accepts are merged per address and dispatched once each when the
+    // drain ends, after the rest of that drain's traffic. Add rules through the returned
+    // coalescer; bundles are never coalesced. Messages given to process_packet() are held until
+    // the next process_* call. Replacing an active coalescer dispatches what it still holds first.
+    ValueCoalescer& enable_value_coalescing(const ValueCoalescerOptions& options = {})
+    {
+        flush_coalesced();
+        m_coalescer = std::make_unique<ValueCoalescer>(options);
+        return *m_coalescer;
+    }
+    // Dispatches anything still pending first
+    void disable_value_coalescing()
+    {
+        flush_coalesced();
+        m_coalescer.reset();
+    }
+    // nullptr unless coalescing is enabled
+    const ValueCoalescer* value_coalescer() const
+    {
+        return m_coalescer.get();
+    }
+
+    // Decoupled mode: a background thread drains the transport into a PacketRing and the process_*
+    // calls decode and dispatch from the ring on the caller's thread, so slow handlers no longer
+    // leave packets sitting in the socket buffer. The transport must not be used elsewhere meanwhile.
+    void start_receive_thread(
+        size_t capacity = RECEIVE_QUEUE_CAPACITY, OverflowPolicy policy = OverflowPolicy::DropOldest,
+        size_t max_packet_size = RECEIVE_QUEUE_SLOT_SIZE
+    );
+    void stop_receive_thread();
+    // Depth and drop counters of the decoupled receive queue, nullptr unless it is running
+    const PacketRing* receive_queue() const
+    {
+        return m_ring.get();
+    }
+
+    // Sees every packet before it is decoded. Returning false tells the server the filter has
+    // taken care of the packet, and it is neither dispatched nor counted in the receive timing.
+    // packet_info() already describes the packet while the filter runs.
+    using PacketFilter = std::function<bool(const uint8_t*, size_t)>;
+    void set_packet_filter(PacketFilter filter)
+    {
+        m_packet_filter = filter;
+    }
+
+    // Records every packet reaching the server, ahead of the packet filter, with its PacketInfo.
+    // The writer is not owned and must outlive the server; pass nullptr to stop capturing. If a
+    // write fails (a full disk, say) the writer is detached and PacketError::CaptureFailed reported.
+    void set_capture(CaptureWriter* writer)
+    {
+        m_capture = writer;
+    }
+
+    // Called with every packet that fails to decode or whose handlers throw. At most
+    // max_per_second errors are reported and the rest are only counted, so a flood of junk costs
+    // little more than the validation pass. Without a handler errors are written to std::cerr.
+    // Only exceptions from handlers become HandlerException; the server's own failures, such as
+    // std::bad_alloc while decoding, propagate out of the process_* call.
+    using ErrorHandler = std::function<void(PacketError, const uint8_t*, size_t)>;
+    void set_error_handler(ErrorHandler handler, size_t max_per_second = ERROR_REPORTS_PER_SECOND)
+    {
+        m_error_handler = handler;
+        m_error_limit   = max_per_second;
+    }
+    // Errors dropped by the rate limit so far
+    uint64_t suppressed_errors() const
+    {
+        return m_errors_suppressed;
+    }
+
+    // Traffic, error and handler time counters; call snapshot() on it from any thread
+    const Stats& stats() const
+    {
+        return m_stats;
+    }
+
+    // The transport's descriptor for event loops to poll before calling process_all(), or -1
+    // while the receive thread runs or if the transport has none
+    int native_handle() const
+    {
+        return m_ring ? -1 : m_transport->native_handle();
+    }
+
+    // Decodes and dispatches a packet that was obtained outside of the server's own transport.
+    // Returns false if it could not be decoded.
+    bool process_packet(const uint8_t* data, size_t size, const PacketInfo& info = {});
+    // Receive timestamp and sender of the packet being dispatched, for use inside handlers.
+    // Zeroed for bundles released by the scheduler and for packets given without a PacketInfo.
+    const PacketInfo& packet_info() const
+    {
+        return m_packet_info;
+    }
+
+    // Tracks, per sender, the receive timestamp minus the timetag of every non-immediate bundle
+    // (see SourceTiming). Needs a transport that timestamps packets, such as a UDPTransport with
+    // `timestamps` set. Senders beyond max_sources are ignored.
+    void enable_source_timing(size_t max_sources = TIMING_MAX_SOURCES)
+    {
+        m_timing_max_sources = max_sources;
+    }
+    void disable_source_timing()
+    {
+        m_timing_max_sources = 0;
+        m_timing.clear();
+    }
+    // Call from the thread running the process_* functions
+    std::vector<SourceTiming> source_timing() const;
+    // Non blocking
+    bool process_one();
+    // Drains every pending packet, receiving up to RECEIVE_BATCH_SIZE of them per transport call.
+    // Returns the number of packets dispatched.
+    int process_all();
+    // Blocks until data is readable, the next scheduled bundle is due or `timeout` elapses (a
+    // negative timeout waits indefinitely), then drains like process_all(). Transports without a
+    // native_handle() are polled every POLL_INTERVAL_MS until the timeout instead, and there a
+    // negative timeout returns after one interval, so looping on this call doesn't spin a core.
+    int wait_and_process(std::chrono::nanoseconds timeout = std::chrono::nanoseconds(-1));
+    // `timeout` shortened to when the next scheduled bundle is due, for callers running their own poll loop
+    std::chrono::nanoseconds next_timeout(std::chrono::nanoseconds timeout = std::chrono::nanoseconds(-1)) const;
+
+private:
+    PacketError dispatch(const uint8_t* data, size_t size);
+    PacketError dispatch_now(const uint8_t* data, size_t size);
+    void report(PacketError error, const uint8_t* data, size_t size);
+    void track_timing(const uint8_t* data, size_t size, const PacketInfo& info);
+    int run_scheduled();
+    void flush_coalesced();
+    void receive_loop();
+
+    Stats m_stats;
+    std::unique_ptr<Transport> m_transport;
+    std::vector<uint8_t> m_buffer;
+    std::vector<PacketBuffer> m_batch;
+    MessageHandler m_msg_handler;
+    BundleHandler m_bundle_handler;
+    MessageViewHandler m_msg_view_handler;
+    BundleViewHandler m_bundle_view_handler;
+    bool m_lazy_bundles {false};
+    AddressSpace* m_address_space {nullptr};
+    std::unique_ptr<BundleScheduler> m_scheduler;
+    std::unique_ptr<ValueCoalescer> m_coalescer;
+    PacketFilter m_packet_filter;
+    CaptureWriter* m_capture {nullptr};
+    ErrorHandler m_error_handler;
+    size_t m_error_limit {ERROR_REPORTS_PER_SECOND};
+    size_t m_errors_in_window {0};
+    std::chrono::steady_clock::time_point m_error_window;
+    uint64_t m_errors_suppressed {0};
+    PacketInfo m_packet_info;
+    size_t m_timing_max_sources {0};
+    std::unordered_map<uint64_t, SourceTiming> m_timing;
+    // Decode targets for the owning handlers, recycled from packet to packet
+    Message m_message {std::string {}};
+    Bundle m_bundle;
+
+    std::unique_ptr<PacketRing> m_ring;
+    std::thread m_receiver;
+    std::atomic<bool> m_receiving {false};
+    // Set by the consumer before it sleeps on m_wake_fds, so the receiver knows to signal it
+    std::atomic<bool> m_consumer_waiting {false};
+    int m_wake_fds[2] {-1, -1};
+    int m_stop_fds[2] {-1, -1};
+};
+
+// Runs one OSCServer per worker thread, each with its own SO_REUSEPORT socket on the same port,
+// so receive, decode and dispatch scale across cores. Handlers are set per shard and run on that
+// shard's thread. With address affinity every packet is handed to the shard owning the hash of
+// its address (bundles go by their first message), so each address is only ever handled by one
+// thread and every peer's messages for it stay in order. Forwarded packets keep their PacketInfo;
+// up to RECEIVE_QUEUE_CAPACITY of them wait per shard and the rest are counted in forward_drops().
+class ShardedOSCServer
+{
+public:
+    // shard_count 0 picks one shard per hardware thread
+    explicit ShardedOSCServer(uint16_t port, size_t shard_count = 0, bool address_affinity = false);
+    ShardedOSCServer(const ShardedOSCServer&)            = delete;
+    ShardedOSCServer& operator=(const ShardedOSCServer&) = delete;
+    ShardedOSCServer(ShardedOSCServer&&)                 = delete;
+    ShardedOSCServer& operator=(ShardedOSCServer&&)      = delete;
+    ~ShardedOSCServer()
+    {
+        stop();
+    }
+
+    size_t size() const
+    {
+        return m_shards.size();
+    }
+    // Configure handlers through the shards before start(); they must not be touched while running
+    OSCServer& shard(size_t index)
+    {
+        return *m_shards.at(index)->server;
+    }
+
+    // Starts one worker per shard, pinning shard i to CPU i when `pin_threads` is set (Linux only)
+    void start(bool pin_threads = true);
+    void stop();
+    bool running() const
+    {
+        return m_running.load(std::memory_order_acquire);
+    }
+    // Sum of every shard's stats
+    StatsSnapshot stats() const;
+
+    // Packets dropped because the owning shard's inbox was full, address affinity only
+    uint64_t forward_drops() const;
+
+private:
+    struct Forwarded
+    {
+        std::vector<uint8_t> bytes;
+        PacketInfo info;
+    };
+
+    // A fixed number of entries whose buffers are kept when the inbox is swapped with the worker's
+    // side, so forwarding stops allocating once they've grown to the traffic's packet sizes
+    struct Inbox
+    {
+        std::vector<Forwarded> entries;
+        size_t size {0};
+    };
+
+    struct Shard
+    {
+        ~Shard();
+
+        std::unique_ptr<OSCServer> server;
+        int socket_fd {-1};
+        int wake_fds[2] {-1, -1};
+        std::thread worker;
+        std::mutex inbox_mutex;
+        Inbox inbox;
+        uint64_t inbox_drops {0};
+    };
+
+    size_t owner_of(const uint8_t* data, size_t size) const;
+    void forward(size_t shard, const uint8_t* data, size_t size, const PacketInfo& info);
+    void run(size_t index);
+
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    std::atomic<bool> m_running {false};
+};
+
+// Single-threaded poll loop multiplexing any number of OSCServers, descriptors and timers. Servers
+// are drained with process_all() whenever their descriptor is readable or a scheduled bundle is
+// due; servers without a descriptor are polled every POLL_INTERVAL_MS. Callbacks run on the thread
+// calling run()/run_once() and may add or remove anything, including themselves. An exception
+// thrown by a callback propagates out of run_once() and leaves the loop usable. On Linux every
+// descriptor stays registered with one epoll instance from watch()/add_server() until its removal,
+// so an iteration costs in proportion to what is ready rather than to what is watched.
+class EventLoop
+{
+public:
+    using Clock    = std::chrono::steady_clock;
+    using Callback = std::function<void()>;
+
+    EventLoop();
+    EventLoop(const EventLoop&)            = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+    ~EventLoop();
+
+    // The server is not owned and must be removed before it is destroyed
+    void add_server(OSCServer& server);
+    void remove_server(OSCServer& server);
+
+    // Calls on_ready every time `fd` polls readable (or writable) until unwatch()
+    uint64_t watch(int fd, Callback on_ready, bool writable = false);
+    void unwatch(uint64_t id);
+    // One-shot; returns false if the timer already fired or was cancelled
+    uint64_t add_timer(Clock::time_point deadline, Callback fn);
+    bool cancel_timer(uint64_t id);
+    // Runs fn on the next iteration, ahead of any polling
+    void post(Callback fn);
+
+    // Runs posted callbacks, then waits until a descriptor is ready, a timer or scheduled bundle
+    // is due, or `timeout` elapses (negative waits indefinitely), and dispatches what is ready.
+    // Returns the number of callbacks run and packets processed.
+    size_t run_once(std::chrono::nanoseconds timeout = std::chrono::nanoseconds(-1));
+    // Iterates until stop() is called or there is nothing left to wait for
+    void run();
+    void stop()
+    {
+        m_stopped = true;
+    }
+
+private:
+    struct Watch
+    {
+        uint64_t id;
+        int fd;
+        bool writable;
+        bool removed;
+        Callback fn;
+    };
+    struct Timer
+    {
+        Clock::time_point deadline;
+        uint64_t id;
+    };
+    // The epoll registrations (pollfd scratch space elsewhere), defined next to the implementation
+    struct PollSet;
+
+    static bool later(const Timer& a, const Timer& b)
+    {
+        return a.deadline != b.deadline ? a.deadline > b.deadline : a.id > b.id;
+    }
+    size_t run_posted();
+    size_t run_timers();
+    bool has_work() const;
+
+    std::vector<OSCServer*> m_servers;
+    // Watches are boxed so that callbacks adding more never move the one running, and an unwatched
+    // one is only freed at the start of the next iteration
+    std::unordered_map<uint64_t, std::unique_ptr<Watch>> m_watches;
+    std::vector<std::unique_ptr<Watch>> m_retired;
+    std::vector<Timer> m_timers;
+    std::unordered_map<uint64_t, Callback> m_timer_callbacks;
+    std::deque<Callback> m_posted;
+    std::unique_ptr<PollSet> m_poll;
+    uint64_t m_next_id {1};
+    bool m_stopped {false};
+};
+
+#if NANOOSC_COROUTINES
+
+template <typename T = void>
+class Task;
+
+template <typename T>
+T run_until_complete(EventLoop& loop, Task<T> task);
+
+namespace detail {
+
+template <typename T>
+struct TaskPromiseBase
+{
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> done) noexcept
+        {
+            auto next = done.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept
+        {}
+    };
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+    FinalAwaiter final_suspend() noexcept
+    {
+        return {};
+    }
+    void unhandled_exception() noexcept
+    {
+        error = std::current_exception();
+    }
+
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase<T>
+{
+    Task<T> get_return_object() noexcept;
+    template <typename U>
+    void return_value(U&& value)
+    {
+        result.emplace(std::forward<U>(value));
+    }
+    T take()
+    {
+        if (this->error) std::rethrow_exception(this->error);
+        return std::move(*result);
+    }
+
+    std::optional<T> result;
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase<void>
+{
+    Task<void> get_return_object() noexcept;
+    void return_void() noexcept
+    {}
+    void take()
+    {
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+// Fire-and-forget coroutine: starts eagerly and frees its frame when it finishes
+struct Detached
+{
+    struct promise_type
+    {
+        Detached get_return_object() noexcept
+        {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void() noexcept
+        {}
+        void unhandled_exception() noexcept
+        {
+            std::terminate();
+        }
+    };
+};
+
+}  // namespace detail
+
+// Lazily started coroutine producing a T. Awaiting it runs it to completion (resuming the
+// awaiter straight from its final suspend) and rethrows anything it threw. Move-only. GCC 12
+// miscompiles a co_await on a Task directly in an if condition; bind the result to a local first.
+template <typename T>
+class Task
+{
+public:
+    using promise_type = detail::TaskPromise<T>;
+
+    Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr))
+    {}
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (m_handle) m_handle.destroy();
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task()
+    {
+        if (m_handle) m_handle.destroy();
+    }
+
+    bool await_ready() const noexcept
+    {
+        return !m_handle || m_handle.done();
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        m_handle.promise().continuation = awaiting;
+        return m_handle;
+    }
+    T await_resume()
+    {
+        return m_handle.promise().take();
+    }
+
+private:
+    friend promise_type;
+    template <typename U>
+    friend U run_until_complete(EventLoop& loop, Task<U> task);
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle)
+    {}
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept
+{
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() noexcept
+{
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+inline Detached run_detached(EventLoop& loop, Task<void> task)
+{
+    try
+    {
+        co_await task;
+    }
+    catch (...)
+    {
+        // Rethrown out of run_once() on the loop's thread
+        loop.post([error = std::current_exception()] { std::rethrow_exception(error); });
+    }
+}
+
+}  // namespace detail
+
+// Runs `task` on the loop without waiting for it: it starts right away and continues whenever
+// what it awaits is ready. An exception escaping it is rethrown from the loop's run_once(). Pass
+// state to coroutine lambdas as parameters: a temporary lambda's captures die with it.
+inline void spawn(EventLoop& loop, Task<void> task)
+{
+    detail::run_detached(loop, std::move(task));
+}
+
+// Iterates `loop` until `task` completes and returns its result
+template <typename T>
+T run_until_complete(EventLoop& loop, Task<T> task)
+{
+    if (!task.await_ready()) task.m_handle.resume();
+    while (!task.await_ready()) loop.run_once();
+    return task.await_resume();
+}
+
+// Resumes the awaiting coroutine from `loop` once `delay` has passed
+inline auto sleep_for(EventLoop& loop, std::chrono::nanoseconds delay)
+{
+    class Awaiter
+    {
+    public:
+        Awaiter(EventLoop& loop, EventLoop::Clock::time_point deadline) : m_loop(loop), m_deadline(deadline)
+        {}
+        Awaiter(const Awaiter&)            = delete;
+        Awaiter& operator=(const Awaiter&) = delete;
+        ~Awaiter()
+        {
+            if (m_timer) m_loop.cancel_timer(m_timer);
+        }
+
+        bool await_ready() const noexcept
+        {
+            return m_deadline <= EventLoop::Clock::now();
+        }
+        void await_suspend(std::coroutine_handle<> awaiting)
+        {
+            m_timer = m_loop.add_timer(
+                m_deadline,
+                [this, awaiting]
+                {
+                    m_timer = 0;
+                    awaiting.resume();
+                }
+            );
+        }
+        void await_resume() noexcept
+        {}
+
+    private:
+        EventLoop& m_loop;
+        EventLoop::Clock::time_point m_deadline;
+        uint64_t m_timer {0};
+    };
+    return Awaiter(loop, EventLoop::Clock::now() + delay);
+}
+
+// Coroutine front end for an OSCServer running on an EventLoop. Takes over the server's message
+// and bundle handlers: every message, those inside bundles included, goes to the oldest
+// coroutine waiting for its address, or is queued (oldest dropped past max_queued) for the next
+// one to ask. Waiters resume from the loop, never from inside the server's dispatch. Waiters and
+// queued messages are indexed by literal address, so only pattern and unfiltered waiters are
+// matched one by one. Coroutines still waiting when the AsyncServer is destroyed are never resumed.
+class AsyncServer
+{
+    struct Waiter;
+    struct WaiterList
+    {
+        Waiter* head {nullptr};
+        Waiter* tail {nullptr};
+    };
+    struct Waiter
+    {
+        AsyncServer* server {nullptr};
+        Waiter* prev {nullptr};
+        Waiter* next {nullptr};
+        // The list it waits in, or nullptr
+        WaiterList* list {nullptr};
+        uint64_t order {0};
+        std::string_view pattern;
+        std::optional<Message> message;
+        std::coroutine_handle<> handle;
+        uint64_t timer {0};
+    };
+
+public:
+    AsyncServer(EventLoop& loop, OSCServer& server, size_t max_queued = ASYNC_QUEUE_CAPACITY)
+        : m_loop(loop), m_server(server), m_max_queued(max_queued)
+    {
+        m_server.set_message_handler([this](const Message& msg) { deliver(msg); });
+        m_server.set_bundle_handler([this](const Bundle& bundle) { deliver(bundle); });
+        m_loop.add_server(m_server);
+    }
+    AsyncServer(const AsyncServer&)            = delete;
+    AsyncServer& operator=(const AsyncServer&) = delete;
+    ~AsyncServer()
+    {
+        m_loop.remove_server(m_server);
+        m_server.set_message_handler(nullptr);
+        m_server.set_bundle_handler(nullptr);
+        while (m_matching.head) unlink(m_matching.head);
+        while (!m_waiting.empty()) unlink(m_waiting.begin()->second.head);
+    }
+
+    // co_await next_message() yields the next message to arrive, or the oldest queued one
+    auto next_message()
+    {
+        return MessageAwaiter<false>(*this, {}, std::chrono::nanoseconds(-1));
+    }
+    // As above but only for addresses matching `pattern` (a literal address or OSC pattern, kept
+    // by reference until resumed); others stay queued. std::nullopt once `timeout` passes.
+    auto next_message(std::string_view pattern, std::chrono::nanoseconds timeout)
+    {
+        return MessageAwaiter<true>(*this, pattern, timeout);
+    }
+    auto next_message(std::chrono::nanoseconds timeout)
+    {
+        return MessageAwaiter<true>(*this, {}, timeout);
+    }
+
+    // Sends `request` through `client` and waits up to `timeout` for a message at `reply_pattern`.
+    // std::nullopt if the send failed or no reply came in time.
+    Task<std::optional<Message>> request(
+        OSCClient& client, const Message& request, std::string reply_pattern, std::chrono::nanoseconds timeout
+    )
+    {
+        if (!client.send_message(request)) co_return std::nullopt;
+        co_return co_await next_message(reply_pattern, timeout);
+    }
+
+    size_t queued() const
+    {
+        return m_queue.size();
+    }
+    // Queued messages discarded because max_queued was reached
+    uint64_t dropped() const
+    {
+        return m_dropped;
+    }
+
+private:
+    template <bool Timed>
+    class MessageAwaiter : Waiter
+    {
+    public:
+        MessageAwaiter(AsyncServer& server, std::string_view pattern, std::chrono::nanoseconds timeout)
+            : m_timeout(timeout)
+        {
+            this->server  = &server;
+            this->pattern = pattern;
+        }
+        MessageAwaiter(const MessageAwaiter&)            = delete;
+        MessageAwaiter& operator=(const MessageAwaiter&) = delete;
+        ~MessageAwaiter()
+        {
+            if (this->list) this->server->unlink(this);
+        }
+
+        bool await_ready()
+        {
+            return this->server->take_queued(*this);
+        }
+        void await_suspend(std::coroutine_handle<> awaiting)
+        {
+            this->handle = awaiting;
+            this->server->link(this);
+            if (Timed && m_timeout >= std::chrono::nanoseconds::zero())
+            {
+                this->timer = this->server->m_loop.add_timer(
+                    EventLoop::Clock::now() + m_timeout,
+                    [this]
+                    {
+                        this->timer = 0;
+                        this->server->unlink(this);
+                        this->handle.resume();
+                    }
+                );
+            }
+        }
+        std::conditional_t<Timed, std::optional<Message>, Message> await_resume()
+        {
+            if constexpr (Timed)
+            {
+                return std::move(this->message);
+            }
+            else
+            {
+                return std::move(*this->message);
+            }
+        }
+
+    private:
+        std::chrono::nanoseconds m_timeout;
+    };
+
+    using Queue = std::list<Message>;
+
+    static bool is_literal(std::string_view pattern)
+    {
+        return !pattern.empty() && pattern[0] == '/' && !detail::is_osc_pattern(pattern);
+    }
+    static bool matches(const Waiter& waiter, const std::string& address)
+    {
+        return waiter.pattern.empty() || detail::match_osc_address(waiter.pattern, address);
+    }
+
+    bool take_queued(Waiter& waiter)
+    {
+        auto entry = m_queue.end();
+        if (is_literal(waiter.pattern))
+        {
+            auto index = m_queued_by_address.find(std::string(waiter.pattern));
+            if (index != m_queued_by_address.end()) entry = index->second.front();
+        }
+        else
+        {
+            for (auto it = m_queue.begin(); it != m_queue.end(); ++it)
+            {
+                if (!matches(waiter, it->address)) continue;
+                entry = it;
+                break;
+            }
+        }
+        if (entry == m_queue.end()) return false;
+        unindex(entry);
+        waiter.message.emplace(std::move(*entry));
+        m_queue.erase(entry);
+        return true;
+    }
+    void unindex(Queue::iterator entry)
+    {
+        // A message leaves the queue only as the oldest one queued for its address
+        auto index = m_queued_by_address.find(entry->address);
+        index->second.pop_front();
+        if (index->second.empty()) m_queued_by_address.erase(index);
+    }
+
+    void deliver(const Message& msg)
+    {
+        // The oldest waiter for this exact address, unless an older pattern waiter matches too
+        Waiter* waiter = nullptr;
+        auto waiting   = m_waiting.find(msg.address);
+        if (waiting != m_waiting.end()) waiter = waiting->second.head;
+        for (Waiter* other = m_matching.head; other; other = other->next)
+        {
+            if (waiter && other->order > waiter->order) break;
+            if (!matches(*other, msg.address)) continue;
+            waiter = other;
+            break;
+        }
+        if (waiter)
+        {
+            waiter->message.emplace(msg);
+            unlink(waiter);
+            m_loop.post([handle = waiter->handle] { handle.resume(); });
+            return;
+        }
+        if (m_max_queued == 0) return;
+        if (m_queue.size() >= m_max_queued)
+        {
+            unindex(m_queue.begin());
+            m_queue.pop_front();
+            ++m_dropped;
+        }
+        m_queue.push_back(msg);
+        m_queued_by_address[msg.address].push_back(std::prev(m_queue.end()));
+    }
+    void deliver(const Bundle& bundle)
+    {
+        for (const auto& msg : bundle.messages) deliver(msg);
+        for (const auto& inner : bundle.bundles) deliver(inner);
+    }
+
+    void link(Waiter* waiter)
+    {
+        WaiterList& list = is_literal(waiter->pattern) ? m_waiting[std::string(waiter->pattern)] : m_matching;
+        waiter->order    = m_next_order++;
+        waiter->list     = &list;
+        waiter->prev     = list.tail;
+        waiter->next     = nullptr;
+        (list.tail ? list.tail->next : list.head) = waiter;
+        list.tail                                 = waiter;
+    }
+    void unlink(Waiter* waiter)
+    {
+        WaiterList& list = *waiter->list;
+        (waiter->prev ? waiter->prev->next : list.head) = waiter->next;
+        (waiter->next ? waiter->next->prev : list.tail) = waiter->prev;
+        waiter->prev = waiter->next = nullptr;
+        waiter->list                = nullptr;
+        if (!list.head && &list != &m_matching) m_waiting.erase(std::string(waiter->pattern));
+        if (waiter->timer) m_loop.cancel_timer(std::exchange(waiter->timer, 0));
+    }
+
+    EventLoop& m_loop;
+    OSCServer& m_server;
+    size_t m_max_queued;
+    // Queued messages oldest first, and per address its entries in the same order
+    Queue m_queue;
+    std::unordered_map<std::string, std::deque<Queue::iterator>> m_queued_by_address;
+    uint64_t m_dropped {0};
+    // Waiting coroutines, oldest first within each list; the nodes live in their awaiters
+    std::unordered_map<std::string, WaiterList> m_waiting;
+    WaiterList m_matching;
+    uint64_t m_next_order {0};
+};
+
+// Coroutine front end for an OSCClient. A send the transport accepts completes without
+// suspending; one it pushes back waits for the descriptor to become writable (at most
+// `timeout`) and is tried once more.
+class AsyncClient
+{
+public:
+    AsyncClient(EventLoop& loop, OSCClient& client) : m_loop(loop), m_client(client)
+    {}
+
+    // co_await async_send(msg) yields whether the message was sent
+    auto async_send(
+        const Message& msg, std::chrono::nanoseconds timeout = std::chrono::milliseconds(ASYNC_SEND_TIMEOUT_MS)
+    )
+    {
+        return make_awaiter([this, &msg] { return m_client.send_message(msg); }, timeout);
+    }
+    auto async_send(
+        const Bundle& bundle, std::chrono::nanoseconds timeout = std::chrono::milliseconds(ASYNC_SEND_TIMEOUT_MS)
+    )
+    {
+        return make_awaiter([this, &bundle] { return m_client.send_bundle(bundle); }, timeout);
+    }
+
+    OSCClient& client()
+    {
+        return m_client;
+    }
+
+private:
+    template <typename Send>
+    class SendAwaiter
+    {
+    public:
+        SendAwaiter(AsyncClient& owner, Send send, std::chrono::nanoseconds timeout)
+            : m_owner(owner), m_send(std::move(send)), m_timeout(timeout)
+        {}
+        SendAwaiter(const SendAwaiter&)            = delete;
+        SendAwaiter& operator=(const SendAwaiter&) = delete;
+        ~SendAwaiter()
+        {
+            if (!m_waiting) return;
+            m_owner.m_loop.unwatch(m_watch);
+            m_owner.m_loop.cancel_timer(m_timer);
+        }
+
+        bool await_ready()
+        {
+            m_sent = m_send();
+            return m_sent || m_owner.m_client.native_handle() < 0;
+        }
+        void await_suspend(std::coroutine_handle<> awaiting)
+        {
+            m_handle     = awaiting;
+            m_waiting    = true;
+            EventLoop& l = m_owner.m_loop;
+            m_watch      = l.watch(m_owner.m_client.native_handle(), [this] { finish(true); }, true);
+            m_timer      = l.add_timer(EventLoop::Clock::now() + m_timeout, [this] { finish(false); });
+        }
+        bool await_resume() const noexcept
+        {
+            return m_sent;
+        }
+
+    private:
+        void finish(bool writable)
+        {
+            EventLoop& l = m_owner.m_loop;
+            l.unwatch(m_watch);
+            l.cancel_timer(m_timer);
+            m_waiting = false;
+            if (writable) m_sent = m_send();
+            l.post([handle = m_handle] { handle.resume(); });
+        }
+
+        AsyncClient& m_owner;
+        Send m_send;
+        std::chrono::nanoseconds m_timeout;
+        std::coroutine_handle<> m_handle;
+        uint64_t m_watch {0};
+        uint64_t m_timer {0};
+        bool m_waiting {false};
+        bool m_sent {false};
+    };
+
+    template <typename Send>
+    SendAwaiter<Send> make_awaiter(Send send, std::chrono::nanoseconds timeout)
+    {
+        return SendAwaiter<Send>(*this, std::move(send), timeout);
+    }
+
+    EventLoop& m_loop;
+    OSCClient& m_client;
+};
+
+#endif  // NANOOSC_COROUTINES
+
+
 }  // namespace NanoOsc
 
 #endif  // NANO_OSC_HPP
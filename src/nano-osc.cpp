@@ -1,122 +1,544 @@
 #include "nano-osc.hpp"
 #include <cerrno>
 #include <cstddef>
+#include <cstdio>
 #include <iomanip>
 #include <iostream>
+#include <new>
 #include <stdexcept>
 #include <system_error>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <linux/errqueue.h>
+#include <linux/futex.h>
+#include <linux/net_tstamp.h>
+#include <netinet/udp.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+// Older C libraries lack the UDP GSO/GRO socket options the kernel has had since 4.18 / 5.0
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
+// Multishot recvmsg and the provided buffer ring arrived with the Linux 6.0 headers
+#if defined(IORING_RECV_MULTISHOT)
+#define NANOOSC_IO_URING 1
+#else
+#define NANOOSC_IO_URING 0
+#endif
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 namespace NanoOsc {
 
+namespace {
+
+// poll() with a nanosecond timeout, negative meaning forever
+int poll_for(struct pollfd* fds, nfds_t count, std::chrono::nanoseconds timeout)
+{
+#if defined(__linux__)
+    struct timespec ts;
+    struct timespec* tsp = nullptr;
+    if (timeout >= std::chrono::nanoseconds::zero())
+    {
+        ts.tv_sec  = static_cast<time_t>(timeout.count() / 1000000000);
+        ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+        tsp        = &ts;
+    }
+    return ::ppoll(fds, count, tsp, nullptr);
+#else
+    int timeout_ms = -1;
+    if (timeout >= std::chrono::nanoseconds::zero())
+    {
+        // Round up so a sub-millisecond deadline does not turn into a busy loop
+        timeout_ms = static_cast<int>((timeout.count() + 999999) / 1000000);
+    }
+    return ::poll(fds, count, timeout_ms);
+#endif
+}
+
+// Non-blocking pipe used to wake a thread sleeping in poll()
+bool open_wake_pipe(int fds[2])
+{
+    if (::pipe(fds) < 0) return false;
+    for (int i = 0; i < 2; ++i)
+    {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL, 0) | O_NONBLOCK);
+    }
+    return true;
+}
+
+void close_wake_pipe(int fds[2])
+{
+    for (int i = 0; i < 2; ++i)
+    {
+        if (fds[i] >= 0) ::close(fds[i]);
+        fds[i] = -1;
+    }
+}
+
+void signal_wake_pipe(int fd)
+{
+    uint8_t wake = 1;
+    // A full pipe already guarantees a wakeup, so a failed write is fine
+    (void)!::write(fd, &wake, 1);
+}
+
+void drain_wake_pipe(int fd)
+{
+    uint8_t drain[64];
+    while (::read(fd, drain, sizeof(drain)) > 0)
+    {
+    }
+}
+
+#if defined(__linux__)
+// Picks the SCM_TIMESTAMPNS / SCM_TIMESTAMPING receive time out of a recvmsg control buffer
+void read_rx_timestamp(struct msghdr& msg, PacketInfo& info)
+{
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c != nullptr; c = CMSG_NXTHDR(&msg, c))
+    {
+        if (c->cmsg_level != SOL_SOCKET) continue;
+        struct timespec ts[3] = {};
+        if (c->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            std::memcpy(ts, CMSG_DATA(c), sizeof(ts[0]));
+        }
+        else if (c->cmsg_type == SCM_TIMESTAMPING)
+        {
+            // ts[0] is the software stamp, ts[2] the raw hardware one
+            std::memcpy(ts, CMSG_DATA(c), sizeof(ts));
+            if (ts[2].tv_sec != 0 || ts[2].tv_nsec != 0)
+            {
+                ts[0]                   = ts[2];
+                info.hardware_timestamp = true;
+            }
+        }
+        else
+        {
+            continue;
+        }
+        info.rx_time_ns = static_cast<int64_t>(ts[0].tv_sec) * 1000000000 + ts[0].tv_nsec;
+    }
+}
+
+// SO_RXQ_OVFL's running drop count and UDP_GRO's segment size; both left alone when absent
+void read_udp_control(struct msghdr& msg, uint32_t& drops, int& segment)
+{
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c != nullptr; c = CMSG_NXTHDR(&msg, c))
+    {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL)
+        {
+            std::memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+        }
+        else if (c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO)
+        {
+            std::memcpy(&segment, CMSG_DATA(c), sizeof(segment));
+        }
+    }
+}
+#endif
+
+}  // namespace
+
+size_t Message::encoded_size() const
+{
+    using namespace detail;
+    size_t size = osc_string_size(address.size()) + osc_string_size(tags.size());
+    for (const auto& arg : arguments)
+    {
+        size += std::visit(
+            [](const auto& value) -> size_t
+            {
+                using T = std::decay_t<decltype(value)>;
+                if constexpr (std::is_same_v<T, OSCString>)
+                {
+                    return osc_string_size(value.size());
+                }
+                else if constexpr (std::is_same_v<T, OSCBlob>)
+                {
+                    return osc_blob_size(value.size());
+                }
+                else
+                {
+                    return sizeof(T);
+                }
+            }, arg
+        );
+    }
+    return size;
+}
+
+const char* to_string(PacketError error)
+{
+    switch (error)
+    {
+        case PacketError::None:
+            return "No error";
+        case PacketError::AddressUnterminated:
+            return "Could not read OSC message address";
+        case PacketError::TypeTagsMissing:
+            return "Could not read OSC message format string";
+        case PacketError::ArgumentsTruncated:
+            return "OSC message arguments exceed packet size";
+        case PacketError::NotABundle:
+            return "Packet is not a bundle";
+        case PacketError::ElementSizeTruncated:
+            return "OSC bundle element size is truncated";
+        case PacketError::ElementTooLarge:
+            return "OSC bundle element exceeds packet size";
+        case PacketError::BundleTooDeep:
+            return "OSC bundles are nested too deeply";
+        case PacketError::CaptureFailed:
+            return "OSC capture file write failed";
+        case PacketError::HandlerException:
+            return "OSC handler threw an exception";
+    }
+    return "Unknown OSC packet error";
+}
+
+StatsSnapshot& StatsSnapshot::operator+=(const StatsSnapshot& other)
+{
+    packets_received    += other.packets_received;
+    bytes_received      += other.bytes_received;
+    packets_sent        += other.packets_sent;
+    bytes_sent          += other.bytes_sent;
+    send_failures       += other.send_failures;
+    send_would_block    += other.send_would_block;
+    messages_dispatched += other.messages_dispatched;
+    bundles_dispatched  += other.bundles_dispatched;
+    kernel_drops        += other.kernel_drops;
+    oversized_drops     += other.oversized_drops;
+    handler_ns_sum             += other.handler_ns_sum;
+    receive_to_dispatch_ns_sum += other.receive_to_dispatch_ns_sum;
+    for (size_t i = 0; i < errors.size(); ++i) errors[i] += other.errors[i];
+    for (size_t i = 0; i < handler_ns.size(); ++i) handler_ns[i] += other.handler_ns[i];
+    for (size_t i = 0; i < receive_to_dispatch_ns.size(); ++i)
+    {
+        receive_to_dispatch_ns[i] += other.receive_to_dispatch_ns[i];
+    }
+    return *this;
+}
+
+uint64_t StatsSnapshot::handler_samples() const
+{
+    uint64_t total = 0;
+    for (uint64_t count : handler_ns) total += count;
+    return total;
+}
+
+uint64_t StatsSnapshot::handler_ns_quantile(double q) const
+{
+    uint64_t total = handler_samples();
+    if (total == 0) return 0;
+    auto rank     = static_cast<uint64_t>(q * static_cast<double>(total - 1));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < handler_ns.size(); ++i)
+    {
+        seen += handler_ns[i];
+        if (seen > rank) return Histogram::lower_bound(i);
+    }
+    return Histogram::lower_bound(handler_ns.size() - 1);
+}
+
+std::string StatsSnapshot::to_prometheus(const std::string& prefix) const
+{
+    std::string out;
+    auto counter = [&](const char* name, uint64_t value)
+    {
+        out += "# TYPE " + prefix + "_" + name + " counter\n";
+        out += prefix + "_" + name + " " + std::to_string(value) + "\n";
+    };
+    counter("packets_received_total", packets_received);
+    counter("bytes_received_total", bytes_received);
+    counter("packets_sent_total", packets_sent);
+    counter("bytes_sent_total", bytes_sent);
+    counter("send_failures_total", send_failures);
+    counter("send_would_block_total", send_would_block);
+    counter("messages_dispatched_total", messages_dispatched);
+    counter("bundles_dispatched_total", bundles_dispatched);
+    counter("kernel_drops_total", kernel_drops);
+    counter("oversized_drops_total", oversized_drops);
+
+    static const char* const error_labels[] = {"none", "address_unterminated", "type_tags_missing",
+                                               "arguments_truncated", "not_a_bundle", "element_size_truncated",
+                                               "element_too_large", "bundle_too_deep", "capture_failed",
+                                               "handler_exception"};
+    static_assert(sizeof(error_labels) / sizeof(error_labels[0]) == PACKET_ERROR_COUNT, "one label per PacketError");
+    out += "# TYPE " + prefix + "_packet_errors_total counter\n";
+    for (size_t i = 1; i < errors.size(); ++i)
+    {
+        out += prefix + "_packet_errors_total{kind=\"" + error_labels[i] + "\"} " + std::to_string(errors[i]) + "\n";
+    }
+
+    // Exported on power-of-two boundaries from 64ns to ~69s so the bucket set is stable across scrapes
+    auto histogram = [&](const char* name, const Histogram::Counts& counts, uint64_t sum_ns)
+    {
+        std::string metric = prefix + "_" + name;
+        out += "# TYPE " + metric + " histogram\n";
+        uint64_t cumulative = 0;
+        size_t bucket       = 0;
+        for (size_t octave = 6; octave <= 36; ++octave)
+        {
+            // 2^octave is the lower bound of bucket SUB_BUCKETS * (octave - 1)
+            for (; bucket < Histogram::SUB_BUCKETS * (octave - 1); ++bucket) cumulative += counts[bucket];
+            char le[32];
+            std::snprintf(le, sizeof(le), "%.9g", static_cast<double>(uint64_t(1) << octave) * 1e-9);
+            out += metric + "_bucket{le=\"" + le + "\"} " + std::to_string(cumulative) + "\n";
+        }
+        for (; bucket < counts.size(); ++bucket) cumulative += counts[bucket];
+        out += metric + "_bucket{le=\"+Inf\"} " + std::to_string(cumulative) + "\n";
+        char sum[32];
+        std::snprintf(sum, sizeof(sum), "%.9f", static_cast<double>(sum_ns) * 1e-9);
+        out += metric + "_sum " + sum + "\n";
+        out += metric + "_count " + std::to_string(cumulative) + "\n";
+    };
+    histogram("handler_seconds", handler_ns, handler_ns_sum);
+    histogram("receive_to_dispatch_seconds", receive_to_dispatch_ns, receive_to_dispatch_ns_sum);
+    return out;
+}
+
+StatsSnapshot Stats::snapshot() const
+{
+    auto load = [](const std::atomic<uint64_t>& counter) { return counter.load(std::memory_order_relaxed); };
+    StatsSnapshot snap;
+    snap.packets_received    = load(m_packets_received);
+    snap.bytes_received      = load(m_bytes_received);
+    snap.packets_sent        = load(m_packets_sent);
+    snap.bytes_sent          = load(m_bytes_sent);
+    snap.send_failures       = load(m_send_failures);
+    snap.send_would_block    = load(m_send_would_block);
+    snap.messages_dispatched = load(m_messages_dispatched);
+    snap.bundles_dispatched  = load(m_bundles_dispatched);
+    snap.kernel_drops        = load(m_kernel_drops);
+    snap.oversized_drops     = load(m_oversized_drops);
+    for (size_t i = 0; i < m_errors.size(); ++i) snap.errors[i] = load(m_errors[i]);
+    m_handler_ns.read(snap.handler_ns);
+    m_receive_to_dispatch_ns.read(snap.receive_to_dispatch_ns);
+    snap.handler_ns_sum             = m_handler_ns.sum();
+    snap.receive_to_dispatch_ns_sum = m_receive_to_dispatch_ns.sum();
+    return snap;
+}
+
+void detail::byteswap32_run(const uint8_t* src, uint8_t* dst, size_t count)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    // Wire order is host order here
+    if (src != dst && count > 0) std::memmove(dst, src, count * 4);
+#else
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i order = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+    );
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), _mm256_shuffle_epi8(v, order));
+    }
+#elif defined(__SSE2__)
+    // No byte shuffle before SSSE3: swap the bytes of each 16-bit half, then swap the halves
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        v         = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        v         = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v         = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), v);
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= count; i += 4)
+    {
+        vst1q_u8(dst + i * 4, vrev32q_u8(vld1q_u8(src + i * 4)));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        uint32_t word = 0;
+        std::memcpy(&word, src + i * 4, 4);
+        word = (word >> 24) | ((word >> 8) & 0x0000FF00u) | ((word << 8) & 0x00FF0000u) | (word << 24);
+        std::memcpy(dst + i * 4, &word, 4);
+    }
+#endif
+}
+
+size_t detail::find_nul(const uint8_t* p, size_t n)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        int mask  = _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+        if (mask != 0) return i + __builtin_ctz(static_cast<unsigned>(mask));
+    }
+#endif
+    // Word at a time: (w - 0x01..) & ~w & 0x80.. is non-zero iff some byte of w is zero
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t w = 0;
+        std::memcpy(&w, p + i, 8);
+        if (((w - 0x0101010101010101ull) & ~w & 0x8080808080808080ull) != 0) break;
+    }
+    for (; i < n; ++i)
+    {
+        if (p[i] == 0x00) return i;
+    }
+    return n;
+}
+
 std::vector<uint8_t> Message::encode() const
+{
+    std::vector<uint8_t> buffer(encoded_size());
+    encode_into(buffer.data(), buffer.size());
+    return buffer;
+}
+
+size_t Message::encode_into(uint8_t* dst, size_t cap) const
 {
     using namespace detail;
-    std::vector<uint8_t> buffer;
-    buffer.reserve(512);
-    add_osc_string(buffer, address);
-    add_osc_string(buffer, tags);
+    uint8_t* out       = dst;
+    const uint8_t* end = dst + cap;
+    if (!add_osc_string(out, end, address) || !add_osc_string(out, end, tags))
+    {
+        return 0;
+    }
 
     for (const auto& arg : arguments)
     {
-        std::visit(
+        bool ok = std::visit(
             [&](const auto& value)
             {
                 using T = std::decay_t<decltype(value)>;
                 if constexpr (std::is_same_v<T, OSCInt>)
                 {
-                    add_osc_int32(buffer, value);
+                    return add_osc_int32(out, end, value);
                 }
                 else if constexpr (std::is_same_v<T, OSCInt64>)
                 {
-                    add_osc_int64(buffer, value);
+                    return add_osc_int64(out, end, value);
                 }
                 else if constexpr (std::is_same_v<T, OSCFloat>)
                 {
-                    add_osc_float32(buffer, value);
+                    return add_osc_float32(out, end, value);
                 }
                 else if constexpr (std::is_same_v<T, OSCFloat64>)
                 {
-                    add_osc_float64(buffer, value);
+                    return add_osc_float64(out, end, value);
                 }
                 else if constexpr (std::is_same_v<T, OSCString>)
                 {
-                    add_osc_string(buffer, value);
+                    return add_osc_string(out, end, value);
                 }
                 else if constexpr (std::is_same_v<T, OSCBlob>)
                 {
-                    add_osc_blob(buffer, value.data(), value.size());
+                    return add_osc_blob(out, end, value.data(), value.size());
                 }
                 else if constexpr (std::is_same_v<T, OSCTimeTag>)
                 {
-                    add_osc_u64(buffer, value);
+                    return add_osc_u64(out, end, value);
                 }
             }, arg
         );
+        if (!ok) return 0;
     }
-    return buffer;
+    return static_cast<size_t>(out - dst);
 }
 
 Message Message::decode(const uint8_t* data, size_t size)
+{
+    Message msg {std::string {}};
+    decode_into(msg, data, size);
+    return msg;
+}
+
+void Message::decode_into(Message& msg, const uint8_t* data, size_t size)
+{
+    PacketError error = try_decode_into(msg, data, size);
+    if (error != PacketError::None) throw std::runtime_error(to_string(error));
+}
+
+PacketError Message::try_decode_into(Message& msg, const uint8_t* data, size_t size)
 {
     using namespace detail;
-    std::string addr;
-    std::string tagstr;
-    size_t offset = 0;
-    if (!read_osc_string(addr, data, size, offset))
+    MessageLayout layout;
+    PacketError error = validate_osc_message(data, size, layout);
+    if (error != PacketError::None) return error;
+    msg.address.assign(layout.address);
+    msg.tags.assign(layout.tags);
+
+    // Overwrite the existing arguments in place so their string and blob storage gets reused
+    size_t count = 0;
+    auto next    = [&]() -> OSCValue&
     {
-        throw std::runtime_error("Could not read OSC message address");
-    }
-    if (!read_osc_string(tagstr, data, size, offset))
+        if (count == msg.arguments.size()) msg.arguments.emplace_back();
+        return msg.arguments[count++];
+    };
+    auto next_string = [&]() -> OSCString&
     {
-        throw std::runtime_error("Could not read OSC message format string");
-    }
-
-    Message msg(addr);
-    msg.tags = tagstr;
+        OSCValue& value = next();
+        if (!std::holds_alternative<OSCString>(value)) value.emplace<OSCString>();
+        return std::get<OSCString>(value);
+    };
+    auto next_blob = [&]() -> OSCBlob&
+    {
+        OSCValue& value = next();
+        if (!std::holds_alternative<OSCBlob>(value)) value.emplace<OSCBlob>();
+        return std::get<OSCBlob>(value);
+    };
 
-    for (char& tag : tagstr)
+    // The layout has been validated, so none of the reads below need bounds checks
+    size_t offset = layout.args_offset;
+    for (char tag : layout.tags.substr(1))
     {
         switch (tag)
         {
             case 'i':
-                msg.arguments.emplace_back(read_osc_int32(data, offset));
+                next() = read_osc_int32(data, offset);
                 break;
             case 'f':
-                msg.arguments.emplace_back(read_osc_float32(data, offset));
+                next() = read_osc_float32(data, offset);
                 break;
             case 'S':
-            case 's': {
-                std::string s;
-                read_osc_string(s, data, size, offset);
-                msg.arguments.emplace_back(s);
+            case 's':
+                read_osc_string(next_string(), data, offset);
                 break;
-            }
-            case 'b': {
-                std::vector<uint8_t> b;
-                read_osc_blob(b, data, size, offset);
-                msg.arguments.emplace_back(b);
+            case 'b':
+                read_osc_blob(next_blob(), data, offset);
                 break;
-            }
-            case 'h': {
-                OSCInt64 i = read_osc_int64(data, offset);
+            case 'h':
+                next() = read_osc_int64(data, offset);
                 break;
-            }
-            case 't': {
-                OSCTimeTag tt = read_osc_timetag(data, offset);
-                msg.arguments.emplace_back(tt);
+            case 't':
+                next() = read_osc_timetag(data, offset);
                 break;
-            }
-            case 'd': {
-                OSCFloat64 f = read_osc_float64(data, offset);
-                msg.arguments.emplace_back(f);
+            case 'd':
+                next() = read_osc_float64(data, offset);
                 break;
-            }
             case 'c': {
                 // an ascii character, sent as 32 bit
                 offset += 4;
@@ -136,156 +558,565 @@ Message Message::decode(const uint8_t* data, size_t size)
                 break;
         }
     }
-    return msg;
+    msg.arguments.erase(msg.arguments.begin() + count, msg.arguments.end());
+    return PacketError::None;
 }
 
-std::vector<uint8_t> Bundle::encode() const
+size_t Bundle::encoded_size() const
 {
-    using namespace detail;
-    std::vector<uint8_t> buffer;
-    buffer.reserve(512);
-    add_osc_string(buffer, std::string_view{BUNDLE_ID.data(), 7});
-
-    for (const auto& msg : messages) {
-        auto m = msg.encode();
-        auto len = m.size();
-        add_osc_u32(buffer, len);
-        buffer.insert(buffer.end(), m.data(), m.data() + len);
+    // "#bundle\0" and the timetag, then a size prefix per element
+    size_t size = BUNDLE_ID.size() + sizeof(OSCTimeTag);
+    for (const auto& msg : messages)
+    {
+        size += 4 + msg.encoded_size();
     }
-
-    for (const auto& bundle : bundles) {
-        auto b = bundle.encode();
-        auto len = b.size();
-        add_osc_u32(buffer, len);
-        buffer.insert(buffer.end(), b.data(), b.data() + len);
+    for (const auto& bundle : bundles)
+    {
+        size += 4 + bundle.encoded_size();
     }
+    return size;
+}
 
+std::vector<uint8_t> Bundle::encode() const
+{
+    std::vector<uint8_t> buffer(encoded_size());
+    encode_into(buffer.data(), buffer.size());
     return buffer;
 }
 
-Bundle Bundle::decode(const uint8_t* data, size_t size)
+size_t Bundle::encode_into(uint8_t* dst, size_t cap) const
 {
     using namespace detail;
-    if (!is_bundle(data))
+    uint8_t* out       = dst;
+    const uint8_t* end = dst + cap;
+    if (!add_osc_string(out, end, std::string_view{BUNDLE_ID.data(), 7}) || !add_osc_u64(out, end, timetag))
+    {
+        return 0;
+    }
+
+    // Each element is encoded in place after its 4-byte size slot, which is then patched
+    auto add_element = [&](const auto& element)
+    {
+        if (end - out < 4) return false;
+        size_t len = element.encode_into(out + 4, static_cast<size_t>(end - out) - 4);
+        if (len == 0) return false;
+        store_u32_be(out, static_cast<uint32_t>(len));
+        out += 4 + len;
+        return true;
+    };
+
+    for (const auto& msg : messages)
+    {
+        if (!add_element(msg)) return 0;
+    }
+    for (const auto& bundle : bundles)
     {
-        throw std::runtime_error("Packet is not a bundle");
+        if (!add_element(bundle)) return 0;
     }
-    size_t offset = 8;
-    OSCTimeTag tt = read_osc_timetag(data, offset);
+    return static_cast<size_t>(out - dst);
+}
+
+Bundle Bundle::decode(const uint8_t* data, size_t size)
+{
     Bundle bundle {};
-    bundle.timetag = tt;
+    decode_into(bundle, data, size);
+    return bundle;
+}
+
+void Bundle::decode_into(Bundle& bundle, const uint8_t* data, size_t size)
+{
+    PacketError error = try_decode_into(bundle, data, size);
+    if (error != PacketError::None) throw std::runtime_error(to_string(error));
+}
+
+namespace {
+
+// Nesting costs only 20 bytes a level, so without a limit a large stream frame recurses until
+// the stack runs out
+PacketError decode_bundle_into(Bundle& bundle, const uint8_t* data, size_t size, int depth)
+{
+    using namespace detail;
+    if (size < 16 || !is_bundle(data)) return PacketError::NotABundle;
+    if (depth >= BUNDLE_MAX_DEPTH) return PacketError::BundleTooDeep;
+    size_t offset  = 8;
+    bundle.timetag = read_osc_timetag(data, offset);
 
+    // Elements are decoded into the existing children, which keeps their storage alive
+    size_t messages = 0;
+    size_t bundles  = 0;
     while (offset < size)
     {
-        auto len  = read_u32_be(data + offset);
-        offset   += 4;
-        if (is_bundle(data + offset))
+        if (size - offset < 4) return PacketError::ElementSizeTruncated;
+        size_t len  = read_u32_be(data + offset);
+        offset     += 4;
+        if (len > size - offset) return PacketError::ElementTooLarge;
+        PacketError error = PacketError::None;
+        if (len >= BUNDLE_ID.size() && is_bundle(data + offset))
         {
-            auto b = Bundle::decode(data + offset, len);
-            bundle.bundles.emplace_back(b);
+            if (bundles == bundle.bundles.size()) bundle.bundles.emplace_back();
+            error = decode_bundle_into(bundle.bundles[bundles++], data + offset, len, depth + 1);
         }
         else
         {
-            auto msg = Message::decode(data + offset, len);
-            bundle.messages.emplace_back(msg);
+            if (messages == bundle.messages.size()) bundle.messages.emplace_back(std::string {});
+            error = Message::try_decode_into(bundle.messages[messages++], data + offset, len);
         }
+        if (error != PacketError::None) return error;
         offset += len;
     }
-
-    return bundle;
+    bundle.messages.erase(bundle.messages.begin() + messages, bundle.messages.end());
+    bundle.bundles.erase(bundle.bundles.begin() + bundles, bundle.bundles.end());
+    return PacketError::None;
 }
 
-bool UDPTransport::setup_client()
+PacketError validate_bundle(const uint8_t* data, size_t size, BundleView& out, int depth) noexcept
 {
-    int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd < 0)
-    {
-        return false;
-    }
-
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port   = htons(m_port);
-
-    if (inet_pton(AF_INET, m_host.c_str(), &server_addr.sin_addr) <= 0)
-    {
-        ::close(fd);
-        return false;
-    }
-
-    if (::connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0)
+    if (depth >= BUNDLE_MAX_DEPTH) return PacketError::BundleTooDeep;
+    PacketError error = BundleView::try_decode_lazy(data, size, out);
+    for (auto it = out.begin(); error == PacketError::None && it != out.end(); ++it)
     {
-        ::close(fd);
-        return false;
+        if (it->is_bundle())
+        {
+            BundleView nested;
+            error = validate_bundle(it->data, it->size, nested, depth + 1);
+        }
+        else
+        {
+            detail::MessageLayout layout;
+            error = detail::validate_osc_message(it->data, it->size, layout);
+        }
     }
+    return error;
+}
 
-    int flags = fcntl(fd, F_GETFL, 0);
-    if (flags < 0)
-    {
-        ::close(fd);
-        return false;
-    }
-    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
-    {
-        ::close(fd);
-        return false;
-    }
+}  // namespace
 
-    m_socket_fd = fd;
-    m_connected = true;
-    return true;
+PacketError Bundle::try_decode_into(Bundle& bundle, const uint8_t* data, size_t size)
+{
+    return decode_bundle_into(bundle, data, size, 0);
 }
 
-bool UDPTransport::setup_server()
+ArgumentView MessageView::operator[](size_t index) const
 {
-    m_socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (m_socket_fd < 0)
-    {
-        return false;
-    }
+    if (index >= size()) throw std::out_of_range("OSC argument index out of range");
+    auto it = begin();
+    for (size_t i = 0; i < index; ++i) ++it;
+    return *it;
+}
 
-    int opt = 1;
-    setsockopt(m_socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+size_t BlobView::read_floats(float* out, size_t max) const
+{
+    size_t count = std::min(size / 4, max);
+    detail::byteswap32_run(data, reinterpret_cast<uint8_t*>(out), count);
+    return count;
+}
 
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family      = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port        = htons(m_port);
+namespace {
 
-    if (bind(m_socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0)
+// Locates the run of `tag` arguments starting at `index` (or just inside the array opened there)
+size_t find_run(const MessageView& msg, size_t index, char tag, const uint8_t*& payload)
+{
+    if (index >= msg.size()) return 0;
+    auto it = msg.begin();
+    for (size_t i = 0; i < index; ++i) ++it;
+    if (it->tag() == '[')
     {
-        ::close(m_socket_fd);
-        m_socket_fd = -1;
-        return false;
+        ++it;
+        ++index;
     }
+    if (index >= msg.size() || it->tag() != tag) return 0;
+    // Argument i is tag character i + 1, after the ','
+    payload      = it->payload();
+    size_t first = index + 1;
+    size_t end   = msg.tags.find_first_not_of(tag, first);
+    return (end == std::string_view::npos ? msg.tags.size() : end) - first;
+}
 
-    int flags = fcntl(m_socket_fd, F_GETFL, 0);
-    fcntl(m_socket_fd, F_SETFL, flags | O_NONBLOCK);
+}  // namespace
 
-    m_connected = true;
-    return true;
+size_t MessageView::read_float_run(size_t index, float* out, size_t max) const
+{
+    const uint8_t* payload = nullptr;
+    size_t count           = std::min(find_run(*this, index, 'f', payload), max);
+    detail::byteswap32_run(payload, reinterpret_cast<uint8_t*>(out), count);
+    return count;
 }
 
-bool UDPTransport::send(const uint8_t* data, size_t size)
+size_t MessageView::read_int32_run(size_t index, int32_t* out, size_t max) const
 {
-    if (!m_connected || m_socket_fd < 0)
-    {
-        return false;
+    const uint8_t* payload = nullptr;
+    size_t count           = std::min(find_run(*this, index, 'i', payload), max);
+    detail::byteswap32_run(payload, reinterpret_cast<uint8_t*>(out), count);
+    return count;
+}
+
+std::vector<float> MessageView::float_run(size_t index) const
+{
+    const uint8_t* payload = nullptr;
+    std::vector<float> values(find_run(*this, index, 'f', payload));
+    detail::byteswap32_run(payload, reinterpret_cast<uint8_t*>(values.data()), values.size());
+    return values;
+}
+
+Message MessageView::to_message() const
+{
+    Message msg(std::string {address});
+    msg.tags.assign(tags.data(), tags.size());
+    msg.arguments.reserve(size());
+    for (const auto& arg : *this)
+    {
+        switch (arg.tag())
+        {
+            case 'i':
+                msg.arguments.emplace_back(arg.as_int32());
+                break;
+            case 'f':
+                msg.arguments.emplace_back(arg.as_float());
+                break;
+            case 'S':
+            case 's':
+                msg.arguments.emplace_back(OSCString {arg.as_string()});
+                break;
+            case 'b': {
+                auto blob = arg.as_blob();
+                msg.arguments.emplace_back(OSCBlob(blob.data, blob.data + blob.size));
+                break;
+            }
+            case 'h':
+                msg.arguments.emplace_back(arg.as_int64());
+                break;
+            case 't':
+                msg.arguments.emplace_back(arg.as_timetag());
+                break;
+            case 'd':
+                msg.arguments.emplace_back(arg.as_float64());
+                break;
+            default:
+                break;
+        }
+    }
+    return msg;
+}
+
+MessageView MessageView::decode(const uint8_t* data, size_t size)
+{
+    MessageView view;
+    PacketError error = try_decode(data, size, view);
+    if (error != PacketError::None) throw std::runtime_error(to_string(error));
+    return view;
+}
+
+PacketError MessageView::try_decode(const uint8_t* data, size_t size, MessageView& out) noexcept
+{
+    using namespace detail;
+    // Validate the whole layout once so iteration never has to fail
+    MessageLayout layout;
+    PacketError error = validate_osc_message(data, size, layout);
+    if (error != PacketError::None) return error;
+    out.address       = layout.address;
+    out.tags          = layout.tags;
+    out.m_data        = data;
+    out.m_size        = size;
+    out.m_args_offset = layout.args_offset;
+    return PacketError::None;
+}
+
+BundleView BundleView::decode(const uint8_t* data, size_t size)
+{
+    BundleView view;
+    PacketError error = try_decode(data, size, view);
+    if (error != PacketError::None) throw std::runtime_error(to_string(error));
+    return view;
+}
+
+BundleView BundleView::decode_lazy(const uint8_t* data, size_t size)
+{
+    BundleView view;
+    PacketError error = try_decode_lazy(data, size, view);
+    if (error != PacketError::None) throw std::runtime_error(to_string(error));
+    return view;
+}
+
+PacketError BundleView::try_decode_lazy(const uint8_t* data, size_t size, BundleView& out) noexcept
+{
+    using namespace detail;
+    if (size < 16 || !is_bundle(data)) return PacketError::NotABundle;
+    size_t offset  = 8;
+    out.timetag    = read_osc_timetag(data, offset);
+    out.m_elements = data + offset;
+    out.m_end      = data + size;
+    while (offset < size)
+    {
+        if (size - offset < 4) return PacketError::ElementSizeTruncated;
+        size_t len  = read_u32_be(data + offset);
+        offset     += 4;
+        if (len > size - offset) return PacketError::ElementTooLarge;
+        offset += len;
+    }
+    return PacketError::None;
+}
+
+PacketError BundleView::try_decode(const uint8_t* data, size_t size, BundleView& out) noexcept
+{
+    return validate_bundle(data, size, out, 0);
+}
+
+CompactMessage::CompactMessage(const Message& msg) : address(msg.address), tags(msg.tags)
+{
+    // The arguments of a Message are encoded back to back right after its address and tags
+    size_t header = detail::osc_string_size(address.size()) + detail::osc_string_size(tags.size());
+    size_t size   = msg.encoded_size();
+    std::vector<uint8_t> encoded(size);
+    msg.encode_into(encoded.data(), size);
+    std::memcpy(m_args.extend(size - header), encoded.data() + header, size - header);
+}
+
+CompactMessage CompactMessage::decode(const uint8_t* data, size_t size)
+{
+    MessageView view = MessageView::decode(data, size);
+    CompactMessage msg {std::string {view.address}};
+    msg.tags.assign(view.tags.data(), view.tags.size());
+    size_t offset = view.m_args_offset;
+    std::memcpy(msg.m_args.extend(size - offset), data + offset, size - offset);
+    return msg;
+}
+
+PacketTemplate::PacketTemplate(const Message& msg) : m_bytes(msg.encode())
+{
+    index_message(MessageView::decode(m_bytes.data(), m_bytes.size()));
+}
+
+PacketTemplate::PacketTemplate(const Bundle& bundle) : m_bytes(bundle.encode())
+{
+    index_bundle(BundleView::decode(m_bytes.data(), m_bytes.size()));
+}
+
+void PacketTemplate::set_bundle_timetag(OSCTimeTag value)
+{
+    if (m_bytes.size() < 16 || !detail::is_bundle(m_bytes.data()))
+    {
+        throw std::runtime_error("Packet template is not a bundle");
+    }
+    detail::store_u64_be(m_bytes.data() + 8, value);
+}
+
+void PacketTemplate::index_message(const MessageView& msg)
+{
+    for (const auto& arg : msg)
+    {
+        // Strings and blobs get a slot too so indices line up, the setters just reject them
+        m_slots.push_back({static_cast<uint32_t>(arg.payload() - m_bytes.data()), arg.tag()});
+    }
+}
+
+void PacketTemplate::index_bundle(const BundleView& bundle)
+{
+    for (const auto& element : bundle)
+    {
+        if (element.is_bundle())
+        {
+            index_bundle(element.bundle());
+        }
+        else
+        {
+            index_message(element.message());
+        }
+    }
+}
+
+bool UDPTransport::setup_client()
+{
+    int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+    {
+        return false;
+    }
+    m_socket_fd = fd;
+    if (!apply_options())
+    {
+        ::close(fd);
+        m_socket_fd = -1;
+        return false;
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port   = htons(m_port);
+
+    if (inet_pton(AF_INET, m_host.c_str(), &server_addr.sin_addr) <= 0)
+    {
+        errno = EINVAL;
+        close();
+        return false;
+    }
+
+    if (::connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0)
+    {
+        close();
+        return false;
+    }
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        close();
+        return false;
+    }
+
+    m_connected = true;
+    return true;
+}
+
+bool UDPTransport::apply_options()
+{
+    const UDPTransportOptions& o = m_options;
+    auto set                     = [this](int level, int name, int value)
+    { return setsockopt(m_socket_fd, level, name, &value, sizeof(value)) == 0; };
+
+    if (o.receive_buffer_size > 0)
+    {
+        bool forced = false;
+#if defined(SO_RCVBUFFORCE)
+        forced = o.force_buffer_sizes && set(SOL_SOCKET, SO_RCVBUFFORCE, o.receive_buffer_size);
+#endif
+        if (!forced && !set(SOL_SOCKET, SO_RCVBUF, o.receive_buffer_size)) return false;
+    }
+    if (o.send_buffer_size > 0)
+    {
+        bool forced = false;
+#if defined(SO_SNDBUFFORCE)
+        forced = o.force_buffer_sizes && set(SOL_SOCKET, SO_SNDBUFFORCE, o.send_buffer_size);
+#endif
+        if (!forced && !set(SOL_SOCKET, SO_SNDBUF, o.send_buffer_size)) return false;
+    }
+    if (o.dscp > 63)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    // Before SO_PRIORITY, since Linux derives the priority from the TOS byte when it is set
+    if (o.dscp >= 0 && !set(IPPROTO_IP, IP_TOS, o.dscp << 2)) return false;
+#if defined(__linux__)
+    if (o.priority >= 0 && !set(SOL_SOCKET, SO_PRIORITY, o.priority)) return false;
+    if (o.busy_poll_us > 0 && !set(SOL_SOCKET, SO_BUSY_POLL, o.busy_poll_us)) return false;
+    if (o.mtu_discover >= 0 && !set(IPPROTO_IP, IP_MTU_DISCOVER, o.mtu_discover)) return false;
+    if (o.incoming_cpu >= 0 && !set(SOL_SOCKET, SO_INCOMING_CPU, o.incoming_cpu)) return false;
+    m_rxq_overflow = o.rxq_overflow && set(SOL_SOCKET, SO_RXQ_OVFL, 1);
+    m_gro          = o.gro && set(SOL_UDP, UDP_GRO, 1);
+    // A zero segment size is accepted by kernels with GSO and keeps it off for plain sends;
+    // send_batch() asks for it per message
+    m_gso = o.gso && set(SOL_UDP, UDP_SEGMENT, 0);
+#endif
+    return true;
+}
+
+bool UDPTransport::setup_server()
+{
+    m_socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_socket_fd < 0)
+    {
+        return false;
+    }
+
+    int opt = 1;
+    setsockopt(m_socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+#if defined(SO_REUSEPORT)
+    if (m_options.reuse_port && setsockopt(m_socket_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    {
+        ::close(m_socket_fd);
+        m_socket_fd = -1;
+        return false;
+    }
+#endif
+#if defined(__linux__)
+    if (m_options.hardware_timestamps)
+    {
+        int flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+                    SOF_TIMESTAMPING_SOFTWARE;
+        if (setsockopt(m_socket_fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0)
+        {
+            m_timestamping = SO_TIMESTAMPING;
+        }
+    }
+    if (m_timestamping == 0 && (m_options.timestamps || m_options.hardware_timestamps) &&
+        setsockopt(m_socket_fd, SOL_SOCKET, SO_TIMESTAMPNS, &opt, sizeof(opt)) == 0)
+    {
+        m_timestamping = SO_TIMESTAMPNS;
+    }
+#endif
+    if (!apply_options())
+    {
+        ::close(m_socket_fd);
+        m_socket_fd = -1;
+        return false;
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family      = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port        = htons(m_port);
+
+    if (bind(m_socket_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0)
+    {
+        ::close(m_socket_fd);
+        m_socket_fd = -1;
+        return false;
+    }
+
+    if (!m_options.multicast_group.empty())
+    {
+        struct ip_mreq membership;
+        memset(&membership, 0, sizeof(membership));
+        membership.imr_interface.s_addr = INADDR_ANY;
+        bool valid = inet_pton(AF_INET, m_options.multicast_group.c_str(), &membership.imr_multiaddr) > 0 &&
+                     (m_options.multicast_interface.empty() ||
+                      inet_pton(AF_INET, m_options.multicast_interface.c_str(), &membership.imr_interface) > 0);
+        if (!valid) errno = EINVAL;
+        if (!valid || setsockopt(m_socket_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0)
+        {
+            ::close(m_socket_fd);
+            m_socket_fd = -1;
+            return false;
+        }
+    }
+
+    int flags = fcntl(m_socket_fd, F_GETFL, 0);
+    fcntl(m_socket_fd, F_SETFL, flags | O_NONBLOCK);
+
+    m_connected = true;
+    return true;
+}
+
+bool UDPTransport::send(const uint8_t* data, size_t size)
+{
+    if (!m_connected || m_socket_fd < 0)
+    {
+        return false;
     }
 
     ssize_t sent = ::send(m_socket_fd, data, size, 0);
-    if (sent < 0)
+    if (sent != static_cast<ssize_t>(size))
     {
+        if (m_stats) m_stats->count_send_failure(sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
         return false;
     }
-    return sent == static_cast<ssize_t>(size);
+    if (m_stats) m_stats->count_sent(1, size);
+    return true;
 }
 
 size_t UDPTransport::receive(uint8_t* buffer, size_t buffer_size)
 {
     if (!m_connected || m_socket_fd < 0) return false;
+    if (m_gro || m_rxq_overflow)
+    {
+        // Only the batched path reads the control data these need
+        PacketBuffer packet;
+        packet.data     = buffer;
+        packet.capacity = buffer_size;
+        return receive_batch(&packet, 1) == 1 ? packet.size : 0;
+    }
 
     ssize_t received = ::recv(m_socket_fd, buffer, buffer_size, 0);
     if (received < 0)
@@ -297,69 +1128,3413 @@ size_t UDPTransport::receive(uint8_t* buffer, size_t buffer_size)
         return 0;
     }
 
+    if (m_stats) m_stats->count_received(static_cast<size_t>(received));
     return static_cast<size_t>(received);
 }
 
-void UDPTransport::close()
+size_t UDPTransport::receive_batch(PacketBuffer* packets, size_t count)
 {
-    if (m_socket_fd >= 0)
+#if defined(__linux__)
+    if (!m_connected || m_socket_fd < 0) return 0;
+
+    constexpr size_t max_batch = 64;
+    // Room for SCM_TIMESTAMPING's three timespecs (which also fits SCM_TIMESTAMPNS), SO_RXQ_OVFL
+    // and UDP_GRO
+    constexpr size_t control_size =
+        CMSG_SPACE(sizeof(struct timespec) * 3) + CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(int));
+    struct mmsghdr msgs[max_batch];
+    struct iovec iovs[max_batch];
+    struct sockaddr_in sources[max_batch];
+    alignas(struct cmsghdr) uint8_t control[max_batch][control_size];
+    uint16_t segment_sizes[max_batch];
+
+    // Segments left over from the last split come first, keeping arrival order
+    size_t filled = m_gro_pending.empty() ? 0 : take_gro_pending(packets, count);
+    if (filled == count) return filled;
+    packets += filled;
+    count   -= filled;
+    if (count > max_batch) count = max_batch;
+    bool want_control = m_timestamping || m_rxq_overflow || m_gro;
+
+    memset(msgs, 0, sizeof(msgs[0]) * count);
+    for (size_t i = 0; i < count; ++i)
     {
-        ::close(m_socket_fd);
-        m_socket_fd = -1;
-        m_connected = false;
+        iovs[i].iov_base            = packets[i].data;
+        iovs[i].iov_len             = packets[i].capacity;
+        msgs[i].msg_hdr.msg_iov     = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen  = 1;
+        msgs[i].msg_hdr.msg_name    = &sources[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(sources[i]);
+        if (want_control)
+        {
+            msgs[i].msg_hdr.msg_control    = control[i];
+            msgs[i].msg_hdr.msg_controllen = control_size;
+        }
     }
-}
-
-bool OSCClient::send_message(const Message& msg)
-{
-    auto data = msg.encode();
-    return send_packet(data.data(), data.size());
-}
 
-bool OSCClient::send_bundle(const Bundle& bundle)
-{
-    auto data = bundle.encode();
-    return send_packet(data.data(), data.size());
+    int received = ::recvmmsg(m_socket_fd, msgs, static_cast<unsigned int>(count), MSG_DONTWAIT, nullptr);
+    if (received < 0)
+    {
+        return filled;
+    }
+    bool coalesced = false;
+    for (int i = 0; i < received; ++i)
+    {
+        PacketInfo& info = packets[i].info;
+        packets[i].size  = msgs[i].msg_len;
+        info             = PacketInfo {};
+        if (msgs[i].msg_hdr.msg_namelen >= sizeof(sources[i]) && sources[i].sin_family == AF_INET)
+        {
+            info.source_address = ntohl(sources[i].sin_addr.s_addr);
+            info.source_port    = ntohs(sources[i].sin_port);
+        }
+        if (m_timestamping) read_rx_timestamp(msgs[i].msg_hdr, info);
+        int segment = 0;
+        if (m_rxq_overflow || m_gro) read_udp_control(msgs[i].msg_hdr, m_kernel_drops, segment);
+        segment_sizes[i] = segment > 0 && static_cast<size_t>(segment) < msgs[i].msg_len ? static_cast<uint16_t>(segment) : 0;
+        coalesced       |= segment_sizes[i] != 0;
+        if (m_stats && segment_sizes[i] == 0) m_stats->count_received(msgs[i].msg_len);
+    }
+    if (m_rxq_overflow && m_stats) m_stats->record_kernel_drops(m_kernel_drops);
+    if (!coalesced) return filled + static_cast<size_t>(received);
+    return filled + split_gro(packets, static_cast<size_t>(received), count, segment_sizes);
+#else
+    return Transport::receive_batch(packets, count);
+#endif
 }
 
-bool OSCClient::send_packet(const uint8_t* data, size_t size)
+size_t UDPTransport::take_gro_pending(PacketBuffer* packets, size_t count)
 {
-    return m_transport->send(data, size);
+    size_t n = 0;
+    while (n < count && m_gro_next < m_gro_pending.size())
+    {
+        const GROSegment& segment = m_gro_pending[m_gro_next++];
+        size_t size               = std::min(segment.size, packets[n].capacity);
+        memcpy(packets[n].data, m_gro_bytes.data() + segment.offset, size);
+        packets[n].size = size;
+        packets[n].info = segment.info;
+        ++n;
+    }
+    if (m_gro_next == m_gro_pending.size())
+    {
+        m_gro_pending.clear();
+        m_gro_bytes.clear();
+        m_gro_next = 0;
+    }
+    return n;
 }
 
-bool OSCServer::process_one()
+size_t UDPTransport::split_gro(PacketBuffer* packets, size_t received, size_t count, const uint16_t* segment_sizes)
 {
-    size_t received = m_transport->receive(m_buffer.data(), m_buffer.size());
-    if (received == 0) return false;
+    // received <= 64, the most receive_batch() asks recvmmsg for
+    size_t pieces[64];
+    size_t total = 0;
+    for (size_t i = 0; i < received; ++i)
+    {
+        size_t segment = segment_sizes[i];
+        pieces[i]      = segment ? (packets[i].size + segment - 1) / segment : 1;
+        total         += pieces[i];
+    }
+    auto piece = [&](size_t i, size_t k)
+    {
+        size_t segment = segment_sizes[i];
+        if (segment == 0) return std::make_pair(static_cast<const uint8_t*>(packets[i].data), packets[i].size);
+        size_t offset = k * segment;
+        return std::make_pair(static_cast<const uint8_t*>(packets[i].data + offset), std::min(segment, packets[i].size - offset));
+    };
 
-    try
+    // Pieces beyond `count` wait for the next call; stash them before anything moves
+    size_t index = 0;
+    for (size_t i = 0; i < received; ++i)
     {
-        using namespace detail;
-        if (is_bundle(m_buffer.data()))
+        for (size_t k = 0; k < pieces[i]; ++k, ++index)
         {
-            auto bundle = Bundle::decode(m_buffer.data(), received);
-            if (m_bundle_handler) m_bundle_handler(bundle);
-            return true;
+            auto [data, size] = piece(i, k);
+            if (m_stats && segment_sizes[i] != 0) m_stats->count_received(size);
+            if (index < count) continue;
+            m_gro_pending.push_back({m_gro_bytes.size(), size, packets[i].info});
+            m_gro_bytes.insert(m_gro_bytes.end(), data, data + size);
         }
-        auto msg = Message::decode(m_buffer.data(), received);
-        if (m_msg_handler) m_msg_handler(msg);
-        return true;
     }
-    catch (const std::exception& e)
+
+    // Back to front, each datagram's pieces only ever move into slots that were already emptied
+    size_t end = total;
+    for (size_t i = received; i-- > 0;)
     {
-        std::cerr << "Error processing OSC packet: " << e.what() << "\n";
-        return false;
+        size_t first = end - pieces[i];
+        for (size_t k = pieces[i]; k-- > 0;)
+        {
+            size_t slot = first + k;
+            if (slot >= count) continue;
+            auto [data, size] = piece(i, k);
+            if (slot != i)
+            {
+                size = std::min(size, packets[slot].capacity);
+                memcpy(packets[slot].data, data, size);
+                packets[slot].info = packets[i].info;
+            }
+            packets[slot].size = size;
+        }
+        end = first;
     }
+    return std::min(total, count);
 }
 
-int OSCServer::process_all()
+size_t UDPTransport::send_batch(const Packet* packets, size_t count)
 {
-    int count = 0;
-    while (process_one())
+#if defined(__linux__)
+    if (!m_connected || m_socket_fd < 0) return 0;
+
+    constexpr size_t max_batch = 64;
+    // UDP_MAX_SEGMENTS on every kernel with GSO, and the payload of the largest datagram
+    constexpr size_t max_segments  = 64;
+    constexpr size_t max_gso_bytes = 65507;
+    struct mmsghdr msgs[max_batch];
+    struct iovec iovs[max_batch];
+    size_t runs[max_batch];
+    alignas(struct cmsghdr) uint8_t control[max_batch][CMSG_SPACE(sizeof(uint16_t))];
+
+    size_t sent = 0;
+    while (sent < count)
     {
-        count++;
-    }
-    return count;
+        // Each message is one packet, or with GSO a run of equal-sized packets plus at most one
+        // shorter one at the end, which the kernel splits back up
+        size_t messages = 0;
+        size_t iovecs   = 0;
+        size_t next     = sent;
+        while (next < count && iovecs < max_batch)
+        {
+            size_t segment = packets[next].size;
+            size_t run     = 1;
+            if (m_gso && segment > 0 && segment <= m_gso_size_limit)
+            {
+                size_t bytes = segment;
+                auto fits    = [&](size_t size)
+                {
+                    return next + run < count && iovecs + run < max_batch && run < max_segments &&
+                           bytes + size <= max_gso_bytes;
+                };
+                while (fits(segment) && packets[next + run].size == segment)
+                {
+                    bytes += segment;
+                    ++run;
+                }
+                if (run > 1 && fits(0) && packets[next + run].size > 0 && packets[next + run].size < segment &&
+                    fits(packets[next + run].size))
+                {
+                    ++run;
+                }
+            }
+
+            struct mmsghdr& msg = msgs[messages];
+            memset(&msg, 0, sizeof(msg));
+            for (size_t k = 0; k < run; ++k)
+            {
+                iovs[iovecs + k].iov_base = const_cast<uint8_t*>(packets[next + k].data);
+                iovs[iovecs + k].iov_len  = packets[next + k].size;
+            }
+            msg.msg_hdr.msg_iov    = &iovs[iovecs];
+            msg.msg_hdr.msg_iovlen = run;
+            if (run > 1)
+            {
+                msg.msg_hdr.msg_control    = control[messages];
+                msg.msg_hdr.msg_controllen = sizeof(control[messages]);
+                struct cmsghdr* c          = CMSG_FIRSTHDR(&msg.msg_hdr);
+                c->cmsg_level              = SOL_UDP;
+                c->cmsg_type               = UDP_SEGMENT;
+                c->cmsg_len                = CMSG_LEN(sizeof(uint16_t));
+                uint16_t size              = static_cast<uint16_t>(segment);
+                memcpy(CMSG_DATA(c), &size, sizeof(size));
+            }
+            runs[messages++]  = run;
+            iovecs           += run;
+            next             += run;
+        }
+
+        int n = ::sendmmsg(m_socket_fd, msgs, static_cast<unsigned int>(messages), 0);
+        if (n < 0 && runs[0] > 1 && errno == EINVAL)
+        {
+            // Segments bigger than the path MTU can't be offloaded; send runs that size one by one
+            m_gso_size_limit = packets[sent].size - 1;
+            continue;
+        }
+        if (n <= 0)
+        {
+            if (m_stats) m_stats->count_send_failure(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+            break;
+        }
+        size_t done  = 0;
+        size_t bytes = 0;
+        for (int i = 0; i < n; ++i) done += runs[i];
+        for (size_t i = 0; i < done; ++i) bytes += packets[sent + i].size;
+        if (m_stats) m_stats->count_sent(done, bytes);
+        sent += done;
+        if (static_cast<size_t>(n) < messages) break;
+    }
+    return sent;
+#else
+    return Transport::send_batch(packets, count);
+#endif
+}
+
+void UDPTransport::close()
+{
+    if (m_socket_fd >= 0)
+    {
+        ::close(m_socket_fd);
+        m_socket_fd = -1;
+        m_connected = false;
+    }
+}
+
+FanoutUDPTransport::FanoutUDPTransport(const FanoutOptions& options) : m_options(options)
+{
+    m_socket_fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_socket_fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "UDP fan-out setup failed");
+    }
+
+    unsigned char ttl  = static_cast<unsigned char>(std::min(std::max(options.multicast_ttl, 0), 255));
+    unsigned char loop = options.multicast_loop ? 1 : 0;
+    struct in_addr interface_addr;
+    interface_addr.s_addr = INADDR_ANY;
+    bool valid            = options.multicast_interface.empty() ||
+                 inet_pton(AF_INET, options.multicast_interface.c_str(), &interface_addr) > 0;
+    if (!valid) errno = EINVAL;
+    int flags = fcntl(m_socket_fd, F_GETFL, 0);
+    if (!valid || setsockopt(m_socket_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 ||
+        setsockopt(m_socket_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0 ||
+        setsockopt(m_socket_fd, IPPROTO_IP, IP_MULTICAST_IF, &interface_addr, sizeof(interface_addr)) < 0 ||
+        flags < 0 || fcntl(m_socket_fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        int err = errno;
+        close();
+        throw std::system_error(err, std::generic_category(), "UDP fan-out setup failed");
+    }
+#if defined(__linux__)
+    // ICMP errors for unconnected sends are otherwise dropped; queued, they name the destination
+    int opt = 1;
+    setsockopt(m_socket_fd, IPPROTO_IP, IP_RECVERR, &opt, sizeof(opt));
+#endif
+}
+
+FanoutUDPTransport::Destination* FanoutUDPTransport::find(uint32_t address, uint16_t port)
+{
+    for (auto& destination : m_destinations)
+    {
+        if (destination.address == address && destination.status.port == port) return &destination;
+    }
+    return nullptr;
+}
+
+bool FanoutUDPTransport::add_destination(const std::string& host, uint16_t port)
+{
+    struct in_addr addr;
+    if (inet_pton(AF_INET, host.c_str(), &addr) <= 0 || find(ntohl(addr.s_addr), port)) return false;
+    Destination destination;
+    destination.status.host = host;
+    destination.status.port = port;
+    destination.address     = ntohl(addr.s_addr);
+    m_destinations.push_back(std::move(destination));
+    return true;
+}
+
+bool FanoutUDPTransport::remove_destination(const std::string& host, uint16_t port)
+{
+    struct in_addr addr;
+    if (inet_pton(AF_INET, host.c_str(), &addr) <= 0) return false;
+    Destination* destination = find(ntohl(addr.s_addr), port);
+    if (!destination) return false;
+    m_destinations.erase(m_destinations.begin() + (destination - m_destinations.data()));
+    return true;
+}
+
+std::vector<FanoutDestination> FanoutUDPTransport::destinations() const
+{
+    auto now = std::chrono::steady_clock::now();
+    std::vector<FanoutDestination> out;
+    out.reserve(m_destinations.size());
+    for (const auto& destination : m_destinations)
+    {
+        out.push_back(destination.status);
+        out.back().suspended = destination.retry_at > now;
+    }
+    return out;
+}
+
+void FanoutUDPTransport::record_error(Destination& destination, int error)
+{
+    destination.status.errors++;
+    destination.status.last_error = error;
+    destination.last_error_at     = std::chrono::steady_clock::now();
+    if (++destination.status.consecutive_errors < m_options.failure_limit) return;
+    destination.retry_at = std::chrono::steady_clock::now() + m_options.retry_interval;
+    // One more error after the retry re-suspends it straight away
+    destination.status.consecutive_errors = m_options.failure_limit > 0 ? m_options.failure_limit - 1 : 0;
+}
+
+void FanoutUDPTransport::drain_errors()
+{
+#if defined(__linux__)
+    for (;;)
+    {
+        struct sockaddr_in target;
+        uint8_t control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name       = &target;
+        msg.msg_namelen    = sizeof(target);
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        if (::recvmsg(m_socket_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) return;
+
+        // msg_name is the address the failed datagram was sent to
+        for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c != nullptr; c = CMSG_NXTHDR(&msg, c))
+        {
+            if (c->cmsg_level != IPPROTO_IP || c->cmsg_type != IP_RECVERR) continue;
+            struct sock_extended_err error;
+            memcpy(&error, CMSG_DATA(c), sizeof(error));
+            Destination* destination = find(ntohl(target.sin_addr.s_addr), ntohs(target.sin_port));
+            if (destination) record_error(*destination, static_cast<int>(error.ee_errno));
+        }
+    }
+#endif
+}
+
+bool FanoutUDPTransport::send(const uint8_t* data, size_t size)
+{
+    Packet packet {data, size};
+    return send_batch(&packet, 1) == 1;
+}
+
+size_t FanoutUDPTransport::send_batch(const Packet* packets, size_t count)
+{
+    if (m_socket_fd < 0 || count == 0) return 0;
+    drain_errors();
+
+    auto now = std::chrono::steady_clock::now();
+    m_active.clear();
+    for (size_t i = 0; i < m_destinations.size(); ++i)
+    {
+        if (m_destinations[i].retry_at <= now) m_active.push_back(i);
+    }
+    m_accepted.assign(count, 0);
+    if (m_active.empty()) return 0;
+
+    // One message per (packet, destination) pair, destinations varying fastest
+    constexpr size_t max_batch = 64;
+    struct mmsghdr msgs[max_batch];
+    struct iovec iovs[max_batch];
+    struct sockaddr_in names[max_batch];
+    size_t pairs    = count * m_active.size();
+    size_t next     = 0;
+    size_t failures = 0;
+    bool would_block = false;
+    while (next < pairs && !would_block)
+    {
+        size_t chunk = std::min(pairs - next, max_batch);
+        memset(msgs, 0, sizeof(msgs[0]) * chunk);
+        memset(names, 0, sizeof(names[0]) * chunk);
+        for (size_t i = 0; i < chunk; ++i)
+        {
+            const Packet& packet      = packets[(next + i) / m_active.size()];
+            const Destination& target = m_destinations[m_active[(next + i) % m_active.size()]];
+            names[i].sin_family       = AF_INET;
+            names[i].sin_addr.s_addr  = htonl(target.address);
+            names[i].sin_port         = htons(target.status.port);
+            iovs[i].iov_base          = const_cast<uint8_t*>(packet.data);
+            iovs[i].iov_len           = packet.size;
+            msgs[i].msg_hdr.msg_name    = &names[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(names[i]);
+            msgs[i].msg_hdr.msg_iov     = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen  = 1;
+        }
+
+        size_t done  = 0;
+        bool retried = false;
+        while (done < chunk)
+        {
+#if defined(__linux__)
+            int n = ::sendmmsg(m_socket_fd, msgs + done, static_cast<unsigned int>(chunk - done), MSG_DONTWAIT);
+#else
+            int n = ::sendmsg(m_socket_fd, &msgs[done].msg_hdr, 0) < 0 ? -1 : 1;
+#endif
+            if (n < 0 && errno == EINTR) continue;
+            if (n > 0)
+            {
+                retried = false;
+                for (int i = 0; i < n; ++i)
+                {
+                    size_t pair = next + done + i;
+                    Destination& target = m_destinations[m_active[pair % m_active.size()]];
+                    target.status.packets_sent++;
+                    if (now - target.last_error_at > m_options.retry_interval) target.status.consecutive_errors = 0;
+                    m_accepted[pair / m_active.size()] = 1;
+                }
+                done += static_cast<size_t>(n);
+                continue;
+            }
+            int error = errno;
+            // An ICMP error from any destination is also returned by the next send, whoever that is
+            // addressed to. The error queue names the real culprit, so drain it and retry this pair
+            // once; failing again straight away means the error really is this destination's.
+            bool stale = error == ECONNREFUSED || error == EHOSTUNREACH || error == ENETUNREACH ||
+                         error == EHOSTDOWN;
+            if (stale && !retried)
+            {
+                drain_errors();
+                retried = true;
+                continue;
+            }
+            retried = false;
+            failures++;
+            if (error == EAGAIN || error == EWOULDBLOCK || error == ENOBUFS)
+            {
+                // The socket buffer is full for everyone, so the rest of the batch would fail too
+                would_block = true;
+                break;
+            }
+            // This destination only (unreachable, refused, ...): skip it and carry on with the others
+            record_error(m_destinations[m_active[(next + done) % m_active.size()]], error);
+            done++;
+        }
+        next += done;
+    }
+
+    size_t sent  = 0;
+    size_t bytes = 0;
+    while (sent < count && m_accepted[sent]) bytes += packets[sent++].size;
+    if (m_stats)
+    {
+        if (sent > 0) m_stats->count_sent(sent, bytes);
+        if (failures > 0) m_stats->count_send_failure(would_block);
+    }
+    return sent;
+}
+
+size_t FanoutUDPTransport::receive(uint8_t* buffer, size_t buffer_size)
+{
+    if (m_socket_fd < 0) return 0;
+    ssize_t received = ::recv(m_socket_fd, buffer, buffer_size, MSG_DONTWAIT);
+    if (received <= 0) return 0;
+    if (m_stats) m_stats->count_received(static_cast<size_t>(received));
+    return static_cast<size_t>(received);
+}
+
+void FanoutUDPTransport::close()
+{
+    if (m_socket_fd >= 0)
+    {
+        ::close(m_socket_fd);
+        m_socket_fd = -1;
+    }
+}
+
+#if NANOOSC_IO_URING
+
+namespace {
+
+int io_uring_setup(unsigned entries, struct io_uring_params* params)
+{
+    return static_cast<int>(syscall(SYS_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return static_cast<int>(syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int io_uring_register(int fd, unsigned opcode, void* arg, unsigned count)
+{
+    return static_cast<int>(syscall(SYS_io_uring_register, fd, opcode, arg, count));
+}
+
+// The ring indices are shared with the kernel
+uint32_t load_acquire(const uint32_t* p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void store_release(uint32_t* p, uint32_t v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+// Control area ahead of each datagram: SCM_TIMESTAMPING's three timespecs plus SO_RXQ_OVFL
+constexpr size_t URING_CONTROL_SIZE = CMSG_SPACE(sizeof(struct timespec) * 3) + CMSG_SPACE(sizeof(uint32_t));
+
+}  // namespace
+
+struct IoUringUDPTransport::Ring
+{
+    ~Ring()
+    {
+        // Closing the ring cancels the multishot receive before its buffers are unmapped
+        if (fd >= 0) ::close(fd);
+        if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_size);
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+        if (buf_ring != MAP_FAILED) munmap(buf_ring, buf_ring_size);
+        if (buffers != MAP_FAILED) munmap(buffers, buffers_size);
+    }
+
+    int fd {-1};
+    void* sq_ptr {MAP_FAILED};
+    void* cq_ptr {MAP_FAILED};
+    void* sqes {MAP_FAILED};
+    void* buf_ring {MAP_FAILED};
+    void* buffers {MAP_FAILED};
+    size_t sq_size {0};
+    size_t cq_size {0};
+    size_t sqes_size {0};
+    size_t buf_ring_size {0};
+    size_t buffers_size {0};
+
+    uint32_t* sq_tail {nullptr};
+    uint32_t* sq_mask {nullptr};
+    uint32_t* sq_flags {nullptr};
+    uint32_t* sq_array {nullptr};
+    uint32_t* cq_head {nullptr};
+    uint32_t* cq_tail {nullptr};
+    uint32_t* cq_mask {nullptr};
+    struct io_uring_cqe* cqes {nullptr};
+
+    uint32_t buffer_count {0};
+    uint32_t buffer_size {0};
+    // Buffers returned to the kernel so far, the provided ring's tail
+    uint16_t buf_tail {0};
+    std::vector<uint16_t> held;
+    bool armed {false};
+    // Template for every multishot completion: lengths of the name and control areas
+    struct msghdr msg {};
+};
+
+IoUringUDPTransport::IoUringUDPTransport(uint16_t port, const UDPTransportOptions& options, const IoUringOptions& uring)
+    : m_udp(port, options), m_control(options.timestamps || options.hardware_timestamps || options.rxq_overflow)
+{
+    // GRO datagrams need splitting, which only UDPTransport's receive path does
+    if (options.gro) return;
+    size_t count = 1;
+    while (count < uring.buffer_count) count <<= 1;
+    // Buffer ids are 16 bits; the header, name and control areas must fit ahead of the payload
+    size_t overhead = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + (m_control ? URING_CONTROL_SIZE : 0);
+    if (count > 32768 || uring.buffer_size <= overhead || uring.buffer_size > UINT32_MAX) return;
+
+    auto ring = std::make_unique<Ring>();
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // Every buffer may be sitting in the completion queue at once
+    params.flags      = IORING_SETUP_CQSIZE;
+    params.cq_entries = static_cast<uint32_t>(count);
+    ring->fd          = io_uring_setup(4, &params);
+    if (ring->fd < 0) return;
+
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) ring->sq_size = ring->cq_size = std::max(ring->sq_size, ring->cq_size);
+    ring->sq_ptr =
+        mmap(nullptr, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) return;
+    ring->cq_ptr = (params.features & IORING_FEAT_SINGLE_MMAP)
+                       ? ring->sq_ptr
+                       : mmap(nullptr, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                              IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes =
+        mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->cq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED) return;
+
+    auto* sq       = static_cast<uint8_t*>(ring->sq_ptr);
+    auto* cq       = static_cast<uint8_t*>(ring->cq_ptr);
+    ring->sq_tail  = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+    ring->sq_mask  = reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+    ring->sq_flags = reinterpret_cast<uint32_t*>(sq + params.sq_off.flags);
+    ring->sq_array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+    ring->cq_head  = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+    ring->cq_tail  = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+    ring->cq_mask  = reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+    ring->cqes     = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // The provided buffer ring (kernel 5.19+) and the buffers it points at, both page aligned
+    ring->buffer_count  = static_cast<uint32_t>(count);
+    ring->buffer_size   = static_cast<uint32_t>(uring.buffer_size);
+    ring->buf_ring_size = count * sizeof(struct io_uring_buf);
+    ring->buffers_size  = count * uring.buffer_size;
+    ring->buf_ring = mmap(nullptr, ring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->buffers  = mmap(nullptr, ring->buffers_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buf_ring == MAP_FAILED || ring->buffers == MAP_FAILED) return;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = reinterpret_cast<uint64_t>(ring->buf_ring);
+    reg.ring_entries = static_cast<uint32_t>(count);
+    reg.bgid         = 0;
+    if (io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return;
+
+    ring->msg.msg_namelen    = sizeof(struct sockaddr_in);
+    ring->msg.msg_controllen = m_control ? URING_CONTROL_SIZE : 0;
+    ring->held.reserve(count);
+    m_ring = std::move(ring);
+    for (uint32_t i = 0; i < count; ++i) m_ring->held.push_back(static_cast<uint16_t>(i));
+    recycle();
+
+    // Multishot recvmsg needs kernel 6.0; an older one fails the request straight away
+    if (!arm()) m_ring.reset();
+}
+
+IoUringUDPTransport::~IoUringUDPTransport()
+{
+    close();
+}
+
+void IoUringUDPTransport::recycle()
+{
+    // Not br->bufs: in C++ the header's flexible array member sits 8 bytes in
+    auto* br      = static_cast<struct io_uring_buf_ring*>(m_ring->buf_ring);
+    auto* bufs    = static_cast<struct io_uring_buf*>(m_ring->buf_ring);
+    uint32_t mask = m_ring->buffer_count - 1;
+    for (uint16_t bid : m_ring->held)
+    {
+        struct io_uring_buf& buf = bufs[m_ring->buf_tail++ & mask];
+        buf.addr = reinterpret_cast<uint64_t>(static_cast<uint8_t*>(m_ring->buffers) + size_t(bid) * m_ring->buffer_size);
+        buf.len  = m_ring->buffer_size;
+        buf.bid  = bid;
+    }
+    if (m_ring->held.empty()) return;
+    m_ring->held.clear();
+    __atomic_store_n(&br->tail, m_ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+bool IoUringUDPTransport::arm()
+{
+    uint32_t tail            = *m_ring->sq_tail;
+    uint32_t index           = tail & *m_ring->sq_mask;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(m_ring->sqes) + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_RECVMSG;
+    sqe->fd        = m_udp.native_handle();
+    sqe->addr      = reinterpret_cast<uint64_t>(&m_ring->msg);
+    sqe->len       = 1;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    m_ring->sq_array[index] = index;
+    store_release(m_ring->sq_tail, tail + 1);
+    if (io_uring_enter(m_ring->fd, 1, 0, 0) != 1) return false;
+
+    // Unsupported requests complete inline with an error; a good one stays quiet until data arrives
+    uint32_t head = *m_ring->cq_head;
+    if (head != load_acquire(m_ring->cq_tail))
+    {
+        const struct io_uring_cqe& cqe = m_ring->cqes[head & *m_ring->cq_mask];
+        if (cqe.res < 0 && cqe.res != -ENOBUFS && !(cqe.flags & IORING_CQE_F_MORE))
+        {
+            store_release(m_ring->cq_head, head + 1);
+            return false;
+        }
+    }
+    m_ring->armed = true;
+    return true;
+}
+
+size_t IoUringUDPTransport::receive_views(Packet* packets, PacketInfo* infos, size_t count)
+{
+    if (!m_ring) return 0;
+    recycle();
+    // Completions the queue had no room for wait in the kernel until we ask for them
+    if (load_acquire(m_ring->sq_flags) & IORING_SQ_CQ_OVERFLOW) io_uring_enter(m_ring->fd, 0, 0, IORING_ENTER_GETEVENTS);
+    if (!m_ring->armed) arm();
+
+    size_t n      = 0;
+    uint32_t head = *m_ring->cq_head;
+    uint32_t tail = load_acquire(m_ring->cq_tail);
+    for (; head != tail && n < count; ++head)
+    {
+        const struct io_uring_cqe& cqe = m_ring->cqes[head & *m_ring->cq_mask];
+        // Out of buffers, an overflowed queue or an error end the multishot; rearmed next call
+        if (!(cqe.flags & IORING_CQE_F_MORE)) m_ring->armed = false;
+        if (cqe.res < 0 || !(cqe.flags & IORING_CQE_F_BUFFER)) continue;
+
+        uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        m_ring->held.push_back(bid);
+        uint8_t* buffer = static_cast<uint8_t*>(m_ring->buffers) + size_t(bid) * m_ring->buffer_size;
+        struct io_uring_recvmsg_out out;
+        memcpy(&out, buffer, sizeof(out));
+        if (out.flags & MSG_TRUNC) continue;
+
+        uint8_t* name     = buffer + sizeof(out);
+        uint8_t* control  = name + m_ring->msg.msg_namelen;
+        uint8_t* payload  = control + m_ring->msg.msg_controllen;
+        PacketInfo& info  = infos[n];
+        info              = PacketInfo {};
+        if (out.namelen >= sizeof(struct sockaddr_in))
+        {
+            struct sockaddr_in source;
+            memcpy(&source, name, sizeof(source));
+            info.source_address = ntohl(source.sin_addr.s_addr);
+            info.source_port    = ntohs(source.sin_port);
+        }
+        if (m_control && out.controllen > 0)
+        {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control    = control;
+            msg.msg_controllen = out.controllen;
+            read_rx_timestamp(msg, info);
+            int segment = 0;
+            read_udp_control(msg, m_kernel_drops, segment);
+            if (m_stats) m_stats->record_kernel_drops(m_kernel_drops);
+        }
+        packets[n++] = {payload, out.payloadlen};
+        if (m_stats) m_stats->count_received(out.payloadlen);
+    }
+    store_release(m_ring->cq_head, head);
+    if (!m_ring->armed && n == 0)
+    {
+        recycle();
+        arm();
+    }
+    return n;
+}
+
+#else
+
+struct IoUringUDPTransport::Ring
+{
+};
+
+IoUringUDPTransport::IoUringUDPTransport(uint16_t port, const UDPTransportOptions& options, const IoUringOptions& uring)
+    : m_udp(port, options)
+{
+    (void)uring;
+}
+
+IoUringUDPTransport::~IoUringUDPTransport()
+{
+    close();
+}
+
+size_t IoUringUDPTransport::receive_views(Packet* packets, PacketInfo* infos, size_t count)
+{
+    (void)packets;
+    (void)infos;
+    (void)count;
+    return 0;
+}
+
+#endif
+
+size_t IoUringUDPTransport::receive(uint8_t* buffer, size_t buffer_size)
+{
+    if (!m_ring) return m_udp.receive(buffer, buffer_size);
+    Packet view;
+    PacketInfo info;
+    while (receive_views(&view, &info, 1) == 1)
+    {
+        if (view.size > buffer_size) continue;
+        memcpy(buffer, view.data, view.size);
+        return view.size;
+    }
+    return 0;
+}
+
+size_t IoUringUDPTransport::receive_batch(PacketBuffer* packets, size_t count)
+{
+    if (!m_ring) return m_udp.receive_batch(packets, count);
+    Packet views[RECEIVE_BATCH_SIZE];
+    PacketInfo infos[RECEIVE_BATCH_SIZE];
+    size_t n        = 0;
+    size_t received = receive_views(views, infos, std::min<size_t>(count, RECEIVE_BATCH_SIZE));
+    for (size_t i = 0; i < received; ++i)
+    {
+        if (views[i].size > packets[n].capacity) continue;
+        memcpy(packets[n].data, views[i].data, views[i].size);
+        packets[n].size   = views[i].size;
+        packets[n++].info = infos[i];
+    }
+    return n;
+}
+
+int IoUringUDPTransport::native_handle() const
+{
+#if NANOOSC_IO_URING
+    if (m_ring) return m_ring->fd;
+#endif
+    return m_udp.native_handle();
+}
+
+void IoUringUDPTransport::close()
+{
+    m_udp.close();
+    m_ring.reset();
+}
+
+uint8_t* FrameParser::write_area(size_t min_free, size_t& available)
+{
+    // Move the frame in progress to the front, dropping everything already consumed
+    if (m_begin > 0)
+    {
+        std::memmove(m_buffer.data(), m_buffer.data() + m_begin, m_end - m_begin);
+        m_end   -= m_begin;
+        m_out   -= m_begin;
+        m_scan  -= m_begin;
+        m_begin  = 0;
+    }
+    // A size-prefixed frame of known length gets room for all of it, so it lands in one piece
+    if (m_framing == TCPFraming::SizePrefix && m_end >= 4)
+    {
+        size_t needed = 4 + static_cast<size_t>(detail::read_u32_be(m_buffer.data()));
+        if (needed > m_end && needed <= m_max_frame_size + 4) min_free = std::max(min_free, needed - m_end);
+    }
+    if (m_buffer.size() - m_end < min_free)
+    {
+        m_buffer.resize(std::max(m_buffer.size() * 2, m_end + min_free));
+    }
+    available = m_buffer.size() - m_end;
+    return m_buffer.data() + m_end;
+}
+
+void FrameParser::commit(size_t n)
+{
+    m_end += n;
+}
+
+bool FrameParser::next(Packet& frame)
+{
+    if (m_failed) return false;
+    uint8_t* buffer = m_buffer.data();
+
+    if (m_framing == TCPFraming::SizePrefix)
+    {
+        while (m_end - m_begin >= 4)
+        {
+            size_t len = detail::read_u32_be(buffer + m_begin);
+            if (len > m_max_frame_size)
+            {
+                m_failed = true;
+                return false;
+            }
+            if (m_end - m_begin - 4 < len) return false;
+            frame.data  = buffer + m_begin + 4;
+            frame.size  = len;
+            m_begin    += 4 + len;
+            m_out = m_scan = m_begin;
+            // Empty frames carry nothing to dispatch
+            if (len > 0) return true;
+        }
+        return false;
+    }
+
+    while (m_scan < m_end)
+    {
+        // Copy the run up to the next special byte down over any escapes undone before it
+        size_t run = m_scan;
+        while (run < m_end && buffer[run] != SLIP_END && buffer[run] != SLIP_ESC) ++run;
+        if (run > m_scan)
+        {
+            if (m_out != m_scan) std::memmove(buffer + m_out, buffer + m_scan, run - m_scan);
+            m_out  += run - m_scan;
+            m_scan  = run;
+        }
+        if (m_out - m_begin > m_max_frame_size)
+        {
+            m_failed = true;
+            return false;
+        }
+        if (m_scan == m_end) break;
+
+        if (buffer[m_scan] == SLIP_END)
+        {
+            frame.data = buffer + m_begin;
+            frame.size = m_out - m_begin;
+            m_begin = m_out = ++m_scan;
+            // Skips the END that opens every frame and any END pairs between frames
+            if (frame.size > 0) return true;
+            continue;
+        }
+        // An ESC whose partner hasn't arrived yet waits for the next read
+        if (m_scan + 1 == m_end) break;
+        uint8_t escaped = buffer[m_scan + 1];
+        buffer[m_out++] = escaped == SLIP_ESC_END ? SLIP_END : (escaped == SLIP_ESC_ESC ? SLIP_ESC : escaped);
+        m_scan         += 2;
+    }
+    return false;
+}
+
+void FrameParser::reset()
+{
+    m_begin  = 0;
+    m_end    = 0;
+    m_out    = 0;
+    m_scan   = 0;
+    m_failed = false;
+}
+
+void FrameParser::encode_slip(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+{
+    out.push_back(SLIP_END);
+    size_t i = 0;
+    while (i < size)
+    {
+        size_t run = i;
+        while (run < size && data[run] != SLIP_END && data[run] != SLIP_ESC) ++run;
+        out.insert(out.end(), data + i, data + run);
+        if (run == size) break;
+        out.push_back(SLIP_ESC);
+        out.push_back(data[run] == SLIP_END ? SLIP_ESC_END : SLIP_ESC_ESC);
+        i = run + 1;
+    }
+    out.push_back(SLIP_END);
+}
+
+namespace {
+
+bool configure_tcp_socket(int fd)
+{
+    int opt = 1;
+    // OSC is latency sensitive, don't let Nagle hold small packets back
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+#if defined(SO_NOSIGPIPE)
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &opt, sizeof(opt));
+#endif
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+#if defined(MSG_NOSIGNAL)
+constexpr int TCP_SEND_FLAGS = MSG_DONTWAIT | MSG_NOSIGNAL;
+#else
+constexpr int TCP_SEND_FLAGS = MSG_DONTWAIT;
+#endif
+
+// Writes the segments from byte `skip` on until the socket would block. Returns the number of
+// bytes written, or -1 on a socket error.
+ssize_t write_segments(int fd, const Packet* segments, size_t count, size_t skip)
+{
+    size_t index = 0;
+    while (index < count && skip >= segments[index].size)
+    {
+        skip -= segments[index].size;
+        index++;
+    }
+    size_t offset = skip;
+    size_t total  = 0;
+
+    constexpr size_t max_iov = 64;
+    struct iovec iov[max_iov];
+    while (index < count)
+    {
+        size_t n = 0;
+        for (size_t i = index; i < count && n < max_iov; ++i, ++n)
+        {
+            size_t from     = i == index ? offset : 0;
+            iov[n].iov_base = const_cast<uint8_t*>(segments[i].data + from);
+            iov[n].iov_len  = segments[i].size - from;
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov     = iov;
+        msg.msg_iovlen  = n;
+        ssize_t written = ::sendmsg(fd, &msg, TCP_SEND_FLAGS);
+        if (written < 0)
+        {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+
+        // Advance past whatever the kernel took, which may end mid-segment
+        total      += static_cast<size_t>(written);
+        size_t left = static_cast<size_t>(written);
+        while (index < count && left >= segments[index].size - offset)
+        {
+            left   -= segments[index].size - offset;
+            offset  = 0;
+            index++;
+        }
+        offset += left;
+    }
+    return static_cast<ssize_t>(total);
+}
+
+}  // namespace
+
+TCPTransport::TCPTransport(const std::string& host, uint16_t port, TCPFraming framing, size_t max_frame_size)
+    : m_framing(framing), m_max_frame_size(max_frame_size), m_is_server(false)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "TCP client setup failed");
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port   = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &server_addr.sin_addr) <= 0 ||
+        ::connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 || !configure_tcp_socket(fd))
+    {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "TCP client setup failed");
+    }
+    add_peer(fd, ntohl(server_addr.sin_addr.s_addr), port);
+}
+
+TCPTransport::TCPTransport(uint16_t port, TCPFraming framing, size_t max_frame_size)
+    : m_framing(framing), m_max_frame_size(max_frame_size), m_is_server(true)
+{
+    m_listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (m_listen_fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "TCP server setup failed");
+    }
+    int opt = 1;
+    setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family      = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port        = htons(port);
+
+    int flags = fcntl(m_listen_fd, F_GETFL, 0);
+    if (bind(m_listen_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0 ||
+        listen(m_listen_fd, SOMAXCONN) < 0 || flags < 0 || fcntl(m_listen_fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        int err = errno;
+        close();
+        throw std::system_error(err, std::generic_category(), "TCP server setup failed");
+    }
+
+#if defined(__linux__)
+    // One descriptor for OSCServer to sleep on that covers new connections and every peer
+    m_poll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events  = EPOLLIN;
+    event.data.fd = m_listen_fd;
+    if (m_poll_fd < 0 || epoll_ctl(m_poll_fd, EPOLL_CTL_ADD, m_listen_fd, &event) < 0)
+    {
+        int err = errno;
+        close();
+        throw std::system_error(err, std::generic_category(), "TCP server setup failed");
+    }
+#endif
+}
+
+void TCPTransport::accept_peers()
+{
+    for (;;)
+    {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int fd        = ::accept(m_listen_fd, (struct sockaddr*)&addr, &len);
+        if (fd < 0) return;
+        if (!configure_tcp_socket(fd))
+        {
+            ::close(fd);
+            continue;
+        }
+        add_peer(fd, ntohl(addr.sin_addr.s_addr), ntohs(addr.sin_port));
+    }
+}
+
+void TCPTransport::add_peer(int fd, uint32_t address, uint16_t port)
+{
+    auto peer                 = std::make_unique<Peer>(fd, m_framing, m_max_frame_size);
+    peer->info.source_address = address;
+    peer->info.source_port    = port;
+#if defined(__linux__)
+    if (m_poll_fd >= 0)
+    {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events  = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = fd;
+        epoll_ctl(m_poll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+#endif
+    m_peers.push_back(std::move(peer));
+}
+
+void TCPTransport::drop_peer(size_t index)
+{
+    // Closing the descriptor also removes it from the epoll set; close_peer may already have closed it
+    if (m_peers[index]->fd >= 0) ::close(m_peers[index]->fd);
+    m_peers.erase(m_peers.begin() + index);
+}
+
+size_t TCPTransport::receive_views(Packet* packets, PacketInfo* infos, size_t count)
+{
+    if (m_listen_fd >= 0) accept_peers();
+    for (auto& peer : m_peers)
+    {
+        if (peer->fd >= 0 && !flush_pending(*peer)) close_peer(*peer);
+    }
+    // Peers are only dropped here, so frames handed out by the previous call stay valid until now
+    for (size_t i = m_peers.size(); i-- > 0;)
+    {
+        if (m_peers[i]->fd < 0) drop_peer(i);
+    }
+
+    size_t n     = 0;
+    size_t peers = m_peers.size();
+    for (size_t visited = 0; visited < peers && n < count; ++visited)
+    {
+        Peer& peer = *m_peers[(m_next_peer + visited) % peers];
+        size_t got = 0;
+        for (;;)
+        {
+            Packet frame;
+            while (n < count && peer.parser.next(frame))
+            {
+                packets[n] = frame;
+                infos[n++] = peer.info;
+                got++;
+                if (m_stats) m_stats->count_received(frame.size);
+            }
+            // Reading again would move the frames just handed out, so stop at the first batch
+            if (got > 0 || n == count) break;
+            if (peer.parser.failed())
+            {
+                // A bad frame length or an oversized frame leaves no way to find the next frame
+                close_peer(peer);
+                break;
+            }
+
+            size_t available = 0;
+            uint8_t* area    = peer.parser.write_area(BUFFER_MAX_SIZE, available);
+            ssize_t received = ::recv(peer.fd, area, available, MSG_DONTWAIT);
+            if (received > 0)
+            {
+                peer.parser.commit(static_cast<size_t>(received));
+                continue;
+            }
+            if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            {
+                // Closed by the peer; the descriptor goes at the start of the next receive
+                close_peer(peer);
+            }
+            break;
+        }
+    }
+    if (peers > 0) m_next_peer = (m_next_peer + 1) % peers;
+    return n;
+}
+
+size_t TCPTransport::receive(uint8_t* buffer, size_t buffer_size)
+{
+    // A single frame is returned per call, so only a dropped oversized frame reads again
+    Packet frame;
+    PacketInfo info;
+    while (receive_views(&frame, &info, 1) == 1)
+    {
+        if (frame.size > buffer_size)
+        {
+            if (m_stats) m_stats->count_oversized_drop();
+            continue;
+        }
+        std::memcpy(buffer, frame.data, frame.size);
+        return frame.size;
+    }
+    return 0;
+}
+
+size_t TCPTransport::receive_batch(PacketBuffer* packets, size_t count)
+{
+    // One receive_views call per batch, so accepting and sweeping the peers happens once rather than per frame
+    Packet views[RECEIVE_BATCH_SIZE];
+    PacketInfo infos[RECEIVE_BATCH_SIZE];
+    size_t n        = 0;
+    size_t received = 0;
+    do
+    {
+        // Only a batch made up entirely of oversized frames reads again, so 0 still means nothing is waiting
+        received = receive_views(views, infos, std::min<size_t>(count, RECEIVE_BATCH_SIZE));
+        for (size_t i = 0; i < received; ++i)
+        {
+            if (views[i].size > packets[n].capacity)
+            {
+                if (m_stats) m_stats->count_oversized_drop();
+                continue;
+            }
+            std::memcpy(packets[n].data, views[i].data, views[i].size);
+            packets[n].size   = views[i].size;
+            packets[n++].info = infos[i];
+        }
+    } while (n == 0 && received > 0);
+    return n;
+}
+
+bool TCPTransport::write_all(int fd, const Packet* segments, size_t count, bool& would_block)
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; ++i) bytes += segments[i].size;
+    size_t done = 0;
+    for (;;)
+    {
+        ssize_t written = write_segments(fd, segments, count, done);
+        if (written < 0) return false;
+        done += static_cast<size_t>(written);
+        if (done == bytes) return true;
+        struct pollfd pfd;
+        pfd.fd      = fd;
+        pfd.events  = POLLOUT;
+        pfd.revents = 0;
+        if (poll_for(&pfd, 1, std::chrono::milliseconds(TCP_SEND_TIMEOUT_MS)) <= 0)
+        {
+            would_block = true;
+            return false;
+        }
+    }
+}
+
+bool TCPTransport::write_queued(Peer& peer, const Packet* segments, size_t count, size_t bytes, bool& would_block)
+{
+    if (!flush_pending(peer)) return false;
+    size_t written = 0;
+    if (peer.pending.empty())
+    {
+        ssize_t n = write_segments(peer.fd, segments, count, 0);
+        if (n < 0) return false;
+        written = static_cast<size_t>(n);
+        if (written == bytes) return true;
+    }
+
+    // Frames have to reach the peer whole and in order, so whatever is left goes behind the queue
+    size_t queued = peer.pending.size() - peer.pending_offset;
+    if (queued + bytes - written > static_cast<size_t>(TCP_SEND_QUEUE_LIMIT))
+    {
+        would_block = true;
+        return false;
+    }
+    if (peer.pending_offset > 0)
+    {
+        peer.pending.erase(peer.pending.begin(), peer.pending.begin() + static_cast<ptrdiff_t>(peer.pending_offset));
+        peer.pending_offset = 0;
+    }
+    bool was_empty = peer.pending.empty();
+    size_t skip    = written;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (skip >= segments[i].size)
+        {
+            skip -= segments[i].size;
+            continue;
+        }
+        peer.pending.insert(peer.pending.end(), segments[i].data + skip, segments[i].data + segments[i].size);
+        skip = 0;
+    }
+    if (was_empty) watch_writable(peer, true);
+    return true;
+}
+
+bool TCPTransport::flush_pending(Peer& peer)
+{
+    if (peer.pending.empty()) return true;
+    while (peer.pending_offset < peer.pending.size())
+    {
+        ssize_t n = ::send(
+            peer.fd, peer.pending.data() + peer.pending_offset, peer.pending.size() - peer.pending_offset,
+            TCP_SEND_FLAGS
+        );
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        peer.pending_offset += static_cast<size_t>(n);
+    }
+    peer.pending.clear();
+    peer.pending_offset = 0;
+    watch_writable(peer, false);
+    return true;
+}
+
+void TCPTransport::watch_writable(Peer& peer, bool writable)
+{
+#if defined(__linux__)
+    // A peer with queued output also wakes the server when it can take more
+    if (m_poll_fd < 0) return;
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    uint32_t events = EPOLLIN | EPOLLRDHUP;
+    if (writable) events |= EPOLLOUT;
+    event.events  = events;
+    event.data.fd = peer.fd;
+    epoll_ctl(m_poll_fd, EPOLL_CTL_MOD, peer.fd, &event);
+#else
+    (void)peer;
+    (void)writable;
+#endif
+}
+
+void TCPTransport::close_peer(Peer& peer)
+{
+    ::close(peer.fd);
+    peer.fd = -1;
+    peer.pending.clear();
+    peer.pending_offset = 0;
+}
+
+bool TCPTransport::send_frames(const Packet* packets, size_t count)
+{
+    // A server that only sends still has to pick up new peers
+    if (m_listen_fd >= 0) accept_peers();
+    size_t bytes = 0;
+    m_segments.clear();
+    m_send_buffer.clear();
+    if (m_framing == TCPFraming::SizePrefix)
+    {
+        // Size prefixes go in m_send_buffer and the payloads are sent from where they are
+        m_send_buffer.resize(4 * count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (packets[i].size > m_max_frame_size) return false;
+            detail::store_u32_be(m_send_buffer.data() + 4 * i, static_cast<uint32_t>(packets[i].size));
+            m_segments.push_back({m_send_buffer.data() + 4 * i, 4});
+            if (packets[i].size > 0) m_segments.push_back(packets[i]);
+            bytes += packets[i].size;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (packets[i].size > m_max_frame_size) return false;
+            FrameParser::encode_slip(packets[i].data, packets[i].size, m_send_buffer);
+            bytes += packets[i].size;
+        }
+        m_segments.push_back({m_send_buffer.data(), m_send_buffer.size()});
+    }
+
+    size_t wire_bytes = 0;
+    for (const auto& segment : m_segments) wire_bytes += segment.size;
+    bool sent = false;
+    for (auto& peer : m_peers)
+    {
+        if (peer->fd < 0) continue;
+        // A server has other peers to serve, so one that is slow to drain mustn't hold up the rest
+        bool would_block = false;
+        bool ok          = m_is_server
+                               ? write_queued(*peer, m_segments.data(), m_segments.size(), wire_bytes, would_block)
+                               : write_all(peer->fd, m_segments.data(), m_segments.size(), would_block);
+        if (ok)
+        {
+            sent = true;
+            if (m_stats) m_stats->count_sent(count, bytes);
+            continue;
+        }
+        // Part of a frame may be on the wire, so the stream can't be trusted any more
+        if (m_stats) m_stats->count_send_failure(would_block);
+        close_peer(*peer);
+    }
+    return sent;
+}
+
+bool TCPTransport::send(const uint8_t* data, size_t size)
+{
+    Packet packet {data, size};
+    return send_frames(&packet, 1);
+}
+
+size_t TCPTransport::send_batch(const Packet* packets, size_t count)
+{
+    return count > 0 && send_frames(packets, count) ? count : 0;
+}
+
+void TCPTransport::close()
+{
+    for (auto& peer : m_peers)
+    {
+        if (peer->fd >= 0) ::close(peer->fd);
+    }
+    m_peers.clear();
+    if (m_listen_fd >= 0)
+    {
+        ::close(m_listen_fd);
+        m_listen_fd = -1;
+    }
+    if (m_poll_fd >= 0)
+    {
+        ::close(m_poll_fd);
+        m_poll_fd = -1;
+    }
+}
+
+// Lives at the start of the segment, followed by the slots. Each slot is a sequence word, the
+// packet size and the packet: its sequence equals its position while free, position + 1 once
+// published, and becomes position + capacity when the receiver frees it for the next lap.
+struct SharedMemoryTransport::Layout
+{
+    static constexpr uint32_t MAGIC   = 0x4f534352;  // "OSCR"
+    static constexpr uint32_t VERSION = 1;
+
+    // Written last by the receiver, so a sender that sees it sees the rest of the header
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint64_t capacity;
+    uint64_t slot_size;
+    uint64_t slot_stride;
+    std::atomic<uint32_t> closed;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> write;
+    // Bumped by a sender waking the receiver, the futex word
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> wake_seq;
+    std::atomic<uint32_t> sleepers;
+};
+
+namespace {
+
+constexpr size_t SHM_SLOT_HEADER = 16;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "Shared memory rings need address-free atomics");
+
+size_t round_up(size_t value, size_t multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+#if defined(__linux__)
+long futex(std::atomic<uint32_t>* word, int op, uint32_t value, const struct timespec* timeout)
+{
+    // Not FUTEX_PRIVATE_FLAG: the word is shared with other processes
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, value, timeout, nullptr, 0);
+}
+#endif
+
+}  // namespace
+
+SharedMemoryTransport::SharedMemoryTransport(
+    const std::string& name, SharedMemoryRole role, const SharedMemoryOptions& options
+)
+    : m_name(name.empty() || name[0] != '/' ? "/" + name : name), m_role(role), m_wakeup(options.wakeup)
+{
+    int fd = -1;
+    if (role == SharedMemoryRole::Receiver)
+    {
+        if (options.slot_size == 0 || options.slot_size > UINT32_MAX)
+        {
+            throw std::invalid_argument("Shared memory slot size out of range");
+        }
+        m_capacity = 2;
+        while (m_capacity < options.capacity) m_capacity <<= 1;
+        m_slot_size   = options.slot_size;
+        m_slot_stride = round_up(SHM_SLOT_HEADER + m_slot_size, CACHE_LINE_SIZE);
+        m_map_size    = round_up(sizeof(Layout), CACHE_LINE_SIZE) + m_capacity * m_slot_stride;
+
+        // A segment left behind by a receiver that crashed is replaced, not reused
+        shm_unlink(m_name.c_str());
+        fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0 || ftruncate(fd, static_cast<off_t>(m_map_size)) < 0)
+        {
+            int err = errno;
+            if (fd >= 0)
+            {
+                ::close(fd);
+                shm_unlink(m_name.c_str());
+            }
+            throw std::system_error(err, std::generic_category(), "Shared memory setup failed");
+        }
+    }
+    else
+    {
+        struct stat st;
+        fd = shm_open(m_name.c_str(), O_RDWR, 0);
+        if (fd < 0 || fstat(fd, &st) < 0)
+        {
+            int err = errno;
+            if (fd >= 0) ::close(fd);
+            throw std::system_error(err, std::generic_category(), "Shared memory setup failed");
+        }
+        m_map_size = static_cast<size_t>(st.st_size);
+        if (m_map_size < sizeof(Layout))
+        {
+            ::close(fd);
+            throw std::runtime_error("Shared memory segment is not an OSC ring");
+        }
+    }
+
+    void* map = mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int err   = errno;
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        if (role == SharedMemoryRole::Receiver) shm_unlink(m_name.c_str());
+        throw std::system_error(err, std::generic_category(), "Shared memory setup failed");
+    }
+
+    if (role == SharedMemoryRole::Receiver)
+    {
+        m_layout              = new (map) Layout;
+        m_layout->version     = Layout::VERSION;
+        m_layout->capacity    = m_capacity;
+        m_layout->slot_size   = m_slot_size;
+        m_layout->slot_stride = m_slot_stride;
+        m_layout->closed.store(0, std::memory_order_relaxed);
+        m_layout->write.store(0, std::memory_order_relaxed);
+        m_layout->wake_seq.store(0, std::memory_order_relaxed);
+        m_layout->sleepers.store(0, std::memory_order_relaxed);
+        for (uint64_t i = 0; i < m_capacity; ++i)
+        {
+            new (slot(i)) std::atomic<uint64_t>(i);
+        }
+        m_layout->magic.store(Layout::MAGIC, std::memory_order_release);
+        return;
+    }
+
+    m_layout = static_cast<Layout*>(map);
+    if (m_layout->magic.load(std::memory_order_acquire) != Layout::MAGIC || m_layout->version != Layout::VERSION)
+    {
+        close();
+        throw std::runtime_error("Shared memory segment is not an OSC ring");
+    }
+    m_capacity    = m_layout->capacity;
+    m_slot_size   = m_layout->slot_size;
+    m_slot_stride = m_layout->slot_stride;
+    // The capacity is used as a mask and the stride to place slots, so neither can be trusted
+    // until the slots they describe are known to fit the mapping. Divides rather than multiplies,
+    // which could wrap.
+    size_t header = round_up(sizeof(Layout), CACHE_LINE_SIZE);
+    bool valid    = m_capacity != 0 && (m_capacity & (m_capacity - 1)) == 0 && m_slot_size != 0 &&
+                 m_slot_size <= UINT32_MAX && m_slot_stride >= SHM_SLOT_HEADER + m_slot_size &&
+                 m_map_size >= header && m_capacity <= (m_map_size - header) / m_slot_stride;
+    if (!valid)
+    {
+        close();
+        throw std::runtime_error("Shared memory segment is not an OSC ring");
+    }
+}
+
+uint8_t* SharedMemoryTransport::slot(uint64_t position) const
+{
+    uint8_t* slots = reinterpret_cast<uint8_t*>(m_layout) + round_up(sizeof(Layout), CACHE_LINE_SIZE);
+    return slots + (position & (m_capacity - 1)) * m_slot_stride;
+}
+
+bool SharedMemoryTransport::push(const uint8_t* data, size_t size)
+{
+    uint64_t position = m_layout->write.load(std::memory_order_relaxed);
+    uint8_t* claimed  = nullptr;
+    for (;;)
+    {
+        claimed       = slot(position);
+        uint64_t seq  = reinterpret_cast<std::atomic<uint64_t>*>(claimed)->load(std::memory_order_acquire);
+        int64_t ahead = static_cast<int64_t>(seq - position);
+        if (ahead == 0)
+        {
+            // Free; claim it unless another sender got there first
+            if (m_layout->write.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+        }
+        else if (ahead < 0)
+        {
+            // Still holds the packet from the previous lap
+            return false;
+        }
+        else
+        {
+            position = m_layout->write.load(std::memory_order_relaxed);
+        }
+    }
+
+    uint32_t length = static_cast<uint32_t>(size);
+    std::memcpy(claimed + 8, &length, sizeof(length));
+    std::memcpy(claimed + SHM_SLOT_HEADER, data, size);
+    reinterpret_cast<std::atomic<uint64_t>*>(claimed)->store(position + 1, std::memory_order_release);
+    return true;
+}
+
+void SharedMemoryTransport::wake()
+{
+    // Pairs with the fence in wait_readable(): either we see the sleeper or it sees our packet
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_layout->sleepers.load(std::memory_order_relaxed) == 0) return;
+    m_layout->wake_seq.fetch_add(1, std::memory_order_release);
+#if defined(__linux__)
+    futex(&m_layout->wake_seq, FUTEX_WAKE, 1, nullptr);
+#endif
+}
+
+bool SharedMemoryTransport::send(const uint8_t* data, size_t size)
+{
+    Packet packet {data, size};
+    return send_batch(&packet, 1) == 1;
+}
+
+size_t SharedMemoryTransport::send_batch(const Packet* packets, size_t count)
+{
+    if (m_role != SharedMemoryRole::Sender || !m_layout || m_layout->closed.load(std::memory_order_relaxed))
+    {
+        return 0;
+    }
+    size_t n     = 0;
+    size_t bytes = 0;
+    for (; n < count; ++n)
+    {
+        if (packets[n].size > m_slot_size || !push(packets[n].data, packets[n].size))
+        {
+            if (m_stats) m_stats->count_send_failure(packets[n].size <= m_slot_size);
+            break;
+        }
+        bytes += packets[n].size;
+    }
+    if (n > 0)
+    {
+        wake();
+        if (m_stats) m_stats->count_sent(n, bytes);
+    }
+    return n;
+}
+
+void SharedMemoryTransport::release_views()
+{
+    for (; m_held > 0; --m_held, ++m_read)
+    {
+        reinterpret_cast<std::atomic<uint64_t>*>(slot(m_read))->store(m_read + m_capacity, std::memory_order_release);
+    }
+}
+
+size_t SharedMemoryTransport::receive_views(Packet* packets, PacketInfo* infos, size_t count)
+{
+    if (m_role != SharedMemoryRole::Receiver || !m_layout) return 0;
+    release_views();
+    size_t n = 0;
+    for (; n < count; ++n)
+    {
+        uint8_t* s = slot(m_read + n);
+        if (reinterpret_cast<std::atomic<uint64_t>*>(s)->load(std::memory_order_acquire) != m_read + n + 1) break;
+        uint32_t length;
+        std::memcpy(&length, s + 8, sizeof(length));
+        packets[n] = {s + SHM_SLOT_HEADER, length};
+        infos[n]   = PacketInfo {};
+        if (m_stats) m_stats->count_received(length);
+    }
+    m_held = n;
+    return n;
+}
+
+size_t SharedMemoryTransport::receive(uint8_t* buffer, size_t buffer_size)
+{
+    Packet view;
+    PacketInfo info;
+    while (receive_views(&view, &info, 1) == 1)
+    {
+        if (view.size > buffer_size) continue;
+        std::memcpy(buffer, view.data, view.size);
+        release_views();
+        return view.size;
+    }
+    return 0;
+}
+
+size_t SharedMemoryTransport::receive_batch(PacketBuffer* packets, size_t count)
+{
+    size_t n = 0;
+    Packet view;
+    PacketInfo info;
+    while (n < count && receive_views(&view, &info, 1) == 1)
+    {
+        if (view.size > packets[n].capacity) continue;
+        std::memcpy(packets[n].data, view.data, view.size);
+        packets[n].size   = view.size;
+        packets[n++].info = info;
+    }
+    release_views();
+    return n;
+}
+
+void SharedMemoryTransport::wait_readable(std::chrono::nanoseconds timeout)
+{
+    if (m_role != SharedMemoryRole::Receiver || !m_layout) return;
+    uint64_t next = m_read + m_held;
+    auto* seq     = reinterpret_cast<std::atomic<uint64_t>*>(slot(next));
+    auto ready    = [&] { return seq->load(std::memory_order_acquire) == next + 1; };
+    if (ready()) return;
+
+#if defined(__linux__)
+    if (m_wakeup == SharedMemoryWakeup::Futex)
+    {
+        uint32_t wake_seq = m_layout->wake_seq.load(std::memory_order_acquire);
+        m_layout->sleepers.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ready())
+        {
+            struct timespec ts;
+            struct timespec* tsp = nullptr;
+            if (timeout >= std::chrono::nanoseconds::zero())
+            {
+                ts.tv_sec  = static_cast<time_t>(timeout.count() / 1000000000);
+                ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+                tsp        = &ts;
+            }
+            futex(&m_layout->wake_seq, FUTEX_WAIT, wake_seq, tsp);
+        }
+        m_layout->sleepers.fetch_sub(1, std::memory_order_relaxed);
+        return;
+    }
+#endif
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!ready())
+    {
+        if (timeout >= std::chrono::nanoseconds::zero() && std::chrono::steady_clock::now() >= deadline) return;
+        std::this_thread::yield();
+    }
+}
+
+void SharedMemoryTransport::close()
+{
+    if (!m_layout) return;
+    if (m_role == SharedMemoryRole::Receiver)
+    {
+        release_views();
+        m_layout->closed.store(1, std::memory_order_relaxed);
+        shm_unlink(m_name.c_str());
+    }
+    munmap(m_layout, m_map_size);
+    m_layout = nullptr;
+}
+
+namespace {
+
+constexpr char CAPTURE_MAGIC[8]          = {'N', 'O', 'S', 'C', 'C', 'A', 'P', 0};
+constexpr uint32_t CAPTURE_VERSION       = 1;
+constexpr size_t CAPTURE_HEADER_SIZE     = 16;
+constexpr size_t CAPTURE_RECORD_HEADER   = 20;
+constexpr uint16_t CAPTURE_HW_TIMESTAMP  = 1;
+
+bool is_capture_header(const uint8_t* header)
+{
+    return std::memcmp(header, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) == 0 &&
+           detail::read_u32_be(header + 8) == CAPTURE_VERSION;
+}
+
+bool write_all(int fd, const uint8_t* data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Length of the records in `data` that are complete, header included. A record cut short by a
+// writer that died mid-append is not.
+size_t complete_capture_size(const uint8_t* data, size_t size)
+{
+    size_t offset = CAPTURE_HEADER_SIZE;
+    while (size - offset >= CAPTURE_RECORD_HEADER)
+    {
+        size_t length = detail::read_u32_be(data + offset);
+        if (size - offset - CAPTURE_RECORD_HEADER < length) break;
+        offset += CAPTURE_RECORD_HEADER + length;
+    }
+    return offset;
+}
+
+}  // namespace
+
+CaptureWriter::CaptureWriter(const std::string& path)
+{
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (m_fd < 0) throw std::system_error(errno, std::generic_category(), "Capture file open failed");
+    struct stat st;
+    if (fstat(m_fd, &st) < 0)
+    {
+        int err = errno;
+        ::close(m_fd);
+        throw std::system_error(err, std::generic_category(), "Capture file open failed");
+    }
+    m_buffer.reserve(CAPTURE_BUFFER_SIZE);
+    size_t size = static_cast<size_t>(st.st_size);
+
+    // A writer that died before its first flush completed leaves part of the header behind
+    size_t keep = 0;
+    if (size >= CAPTURE_HEADER_SIZE)
+    {
+        void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, m_fd, 0);
+        if (map == MAP_FAILED)
+        {
+            int err = errno;
+            ::close(m_fd);
+            throw std::system_error(err, std::generic_category(), "Capture file mmap failed");
+        }
+        const uint8_t* data = static_cast<const uint8_t*>(map);
+        bool valid          = is_capture_header(data);
+        if (valid)
+        {
+            madvise(map, size, MADV_SEQUENTIAL);
+            keep = complete_capture_size(data, size);
+        }
+        munmap(map, size);
+        if (!valid)
+        {
+            ::close(m_fd);
+            throw std::runtime_error("Not an OSC capture file: " + path);
+        }
+    }
+    else if (size > 0)
+    {
+        uint8_t header[CAPTURE_HEADER_SIZE];
+        if (::pread(m_fd, header, size, 0) != static_cast<ssize_t>(size) ||
+            std::memcmp(header, CAPTURE_MAGIC, std::min(size, sizeof(CAPTURE_MAGIC))) != 0)
+        {
+            ::close(m_fd);
+            throw std::runtime_error("Not an OSC capture file: " + path);
+        }
+    }
+
+    // Appending after a torn record would make the reader take the next record's bytes as its tail
+    if (keep != size && ::ftruncate(m_fd, static_cast<off_t>(keep)) < 0)
+    {
+        int err = errno;
+        ::close(m_fd);
+        throw std::system_error(err, std::generic_category(), "Capture file truncate failed");
+    }
+    if (keep == 0)
+    {
+        m_buffer.resize(CAPTURE_HEADER_SIZE);
+        std::memcpy(m_buffer.data(), CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+        detail::store_u32_be(m_buffer.data() + 8, CAPTURE_VERSION);
+        detail::store_u32_be(m_buffer.data() + 12, 0);
+    }
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    try
+    {
+        flush();
+    }
+    catch (const std::exception&)
+    {
+    }
+    ::close(m_fd);
+}
+
+void CaptureWriter::write(const uint8_t* data, size_t size, const PacketInfo& info)
+{
+    if (size > UINT32_MAX) return;
+    if (m_buffer.size() + CAPTURE_RECORD_HEADER + size > CAPTURE_BUFFER_SIZE) flush();
+
+    int64_t rx_time = info.rx_time_ns;
+    if (rx_time == 0)
+    {
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        rx_time  = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+    }
+    size_t at = m_buffer.size();
+    m_buffer.resize(at + CAPTURE_RECORD_HEADER + size);
+    uint8_t* p = m_buffer.data() + at;
+    detail::store_u32_be(p, static_cast<uint32_t>(size));
+    detail::store_u64_be(p + 4, static_cast<uint64_t>(rx_time));
+    detail::store_u32_be(p + 12, info.source_address);
+    p[16] = static_cast<uint8_t>(info.source_port >> 8);
+    p[17] = static_cast<uint8_t>(info.source_port);
+    p[18] = 0;
+    p[19] = info.hardware_timestamp ? CAPTURE_HW_TIMESTAMP : 0;
+    if (size > 0) std::memcpy(p + CAPTURE_RECORD_HEADER, data, size);
+    ++m_records;
+}
+
+void CaptureWriter::flush()
+{
+    if (m_buffer.empty()) return;
+    bool ok = write_all(m_fd, m_buffer.data(), m_buffer.size());
+    m_buffer.clear();
+    if (!ok) throw std::system_error(errno, std::generic_category(), "Capture file write failed");
+}
+
+CaptureReader::CaptureReader(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        int err = errno;
+        if (fd >= 0) ::close(fd);
+        throw std::system_error(err, std::generic_category(), "Capture file open failed");
+    }
+    m_size = static_cast<size_t>(st.st_size);
+    if (m_size < CAPTURE_HEADER_SIZE)
+    {
+        ::close(fd);
+        throw std::runtime_error("Not an OSC capture file: " + path);
+    }
+    void* map = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err   = errno;
+    ::close(fd);
+    if (map == MAP_FAILED) throw std::system_error(err, std::generic_category(), "Capture file mmap failed");
+    m_data = static_cast<const uint8_t*>(map);
+    if (!is_capture_header(m_data))
+    {
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+        throw std::runtime_error("Not an OSC capture file: " + path);
+    }
+    madvise(const_cast<uint8_t*>(m_data), m_size, MADV_SEQUENTIAL);
+    m_offset = CAPTURE_HEADER_SIZE;
+}
+
+CaptureReader::~CaptureReader()
+{
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+}
+
+bool CaptureReader::next(CaptureRecord& out)
+{
+    if (m_size - m_offset < CAPTURE_RECORD_HEADER) return false;
+    const uint8_t* p = m_data + m_offset;
+    size_t size      = detail::read_u32_be(p);
+    if (m_size - m_offset - CAPTURE_RECORD_HEADER < size) return false;
+    out.data                    = p + CAPTURE_RECORD_HEADER;
+    out.size                    = size;
+    out.info.rx_time_ns         = static_cast<int64_t>(detail::read_u64_be(p + 4));
+    out.info.source_address     = detail::read_u32_be(p + 12);
+    out.info.source_port        = static_cast<uint16_t>((p[16] << 8) | p[17]);
+    out.info.hardware_timestamp = (p[19] & CAPTURE_HW_TIMESTAMP) != 0;
+    m_offset                   += CAPTURE_RECORD_HEADER + size;
+    return true;
+}
+
+void CaptureReader::rewind()
+{
+    m_offset = CAPTURE_HEADER_SIZE;
+}
+
+size_t CaptureReader::replay(Transport& transport, double speed)
+{
+    size_t sent = 0;
+    CaptureRecord record;
+    if (speed <= 0)
+    {
+        Packet batch[RECEIVE_BATCH_SIZE];
+        size_t count = 0;
+        while (next(record))
+        {
+            batch[count++] = {record.data, record.size};
+            if (count == RECEIVE_BATCH_SIZE)
+            {
+                sent  += transport.send_batch(batch, count);
+                count  = 0;
+            }
+        }
+        if (count > 0) sent += transport.send_batch(batch, count);
+        return sent;
+    }
+
+    auto start    = std::chrono::steady_clock::now();
+    int64_t first = 0;
+    bool started  = false;
+    while (next(record))
+    {
+        if (!started)
+        {
+            first   = record.info.rx_time_ns;
+            started = true;
+        }
+        // Records stamped before the first one (the capturing clock stepped back) go out at once
+        int64_t offset = record.info.rx_time_ns - first;
+        if (offset > 0)
+        {
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds(static_cast<int64_t>(offset / speed)));
+        }
+        if (transport.send(record.data, record.size)) ++sent;
+    }
+    return sent;
+}
+
+template <typename Encoder, typename Sizer>
+bool OSCClient::send_encoded(Encoder&& encode, Sizer&& encoded_size)
+{
+    if (m_coalesce_mtu == 0) return send_uncoalesced(encode, encoded_size);
+
+    // Each element goes in behind its 4-byte size, after the header when the bundle is new
+    const size_t header = BUNDLE_ID.size() + sizeof(OSCTimeTag);
+    bool ok             = true;
+    size_t offset       = m_coalesce_count > 0 ? m_coalesce_size : header;
+    size_t size         = encode(m_coalesce.data() + offset + 4, m_coalesce_mtu - offset - 4);
+    if (size == 0 && m_coalesce_count > 0)
+    {
+        // No room behind the open bundle's packets: send them and start over with this one
+        ok     = send_coalesced();
+        offset = header;
+        size   = encode(m_coalesce.data() + offset + 4, m_coalesce_mtu - offset - 4);
+    }
+    if (size == 0) return send_uncoalesced(encode, encoded_size) && ok;
+
+    auto now = std::chrono::steady_clock::now();
+    if (m_coalesce_count == 0)
+    {
+        std::memcpy(m_coalesce.data(), BUNDLE_ID.data(), BUNDLE_ID.size());
+        detail::store_u64_be(m_coalesce.data() + BUNDLE_ID.size(), TIMETAG_IMMEDIATE);
+        m_coalesce_deadline = now + m_coalesce_delay;
+    }
+    detail::store_u32_be(m_coalesce.data() + offset, static_cast<uint32_t>(size));
+    m_coalesce_size = offset + 4 + size;
+    m_coalesce_count++;
+
+    // Send once not even a size and the smallest message ("/" with no arguments) would fit
+    bool full    = m_coalesce_mtu - m_coalesce_size < 4 + 8;
+    bool expired = m_coalesce_delay.count() > 0 && now >= m_coalesce_deadline;
+    if (full || expired) return send_coalesced() && ok;
+    return ok;
+}
+
+template <typename Encoder, typename Sizer>
+bool OSCClient::send_uncoalesced(Encoder&& encode, Sizer&& encoded_size)
+{
+    // Packets bigger than the scratch buffer, such as large blobs for a stream transport, grow it
+    // and go out on their own. Only called with nothing queued, as it moves the buffer.
+    auto send_large = [&]()
+    {
+        size_t needed = encoded_size();
+        if (needed <= m_buffer.size()) return false;
+        m_buffer.resize(needed);
+        size_t size = encode(m_buffer.data(), m_buffer.size());
+        return size != 0 && m_transport->send(m_buffer.data(), size);
+    };
+
+    if (m_queue_max_packets == 0)
+    {
+        size_t size = encode(m_buffer.data(), m_buffer.size());
+        if (size == 0) return send_large();
+        return m_transport->send(m_buffer.data(), size);
+    }
+
+    size_t size = encode(m_buffer.data() + m_queue_bytes, m_buffer.size() - m_queue_bytes);
+    if (size == 0 && !m_queue.empty())
+    {
+        // Out of room behind the pending packets: push them out and retry from the start
+        flush();
+        size = encode(m_buffer.data(), m_buffer.size());
+    }
+    if (size == 0) return send_large();
+
+    m_queue.push_back({m_buffer.data() + m_queue_bytes, size});
+    m_queue_bytes += size;
+    if (m_queue.size() >= m_queue_max_packets || m_queue_bytes >= m_queue_max_bytes)
+    {
+        return flush();
+    }
+    return true;
+}
+
+bool OSCClient::send_message(const Message& msg)
+{
+    return send_encoded(
+        [&](uint8_t* dst, size_t cap) { return msg.encode_into(dst, cap); }, [&] { return msg.encoded_size(); }
+    );
+}
+
+bool OSCClient::send_message(const CompactMessage& msg)
+{
+    return send_encoded(
+        [&](uint8_t* dst, size_t cap) { return msg.encode_into(dst, cap); }, [&] { return msg.encoded_size(); }
+    );
+}
+
+bool OSCClient::send_bundle(const Bundle& bundle)
+{
+    return send_encoded(
+        [&](uint8_t* dst, size_t cap) { return bundle.encode_into(dst, cap); }, [&] { return bundle.encoded_size(); }
+    );
+}
+
+bool OSCClient::send_packet(const uint8_t* data, size_t size)
+{
+    if (m_queue_max_packets == 0 && m_coalesce_mtu == 0)
+    {
+        return m_transport->send(data, size);
+    }
+    return send_encoded(
+        [&](uint8_t* dst, size_t cap) -> size_t
+        {
+            if (size == 0 || size > cap) return 0;
+            std::memcpy(dst, data, size);
+            return size;
+        },
+        [&] { return size; }
+    );
+}
+
+void OSCClient::enable_queue(size_t max_packets, size_t max_bytes)
+{
+    flush();
+    m_queue_max_packets = max_packets > 0 ? max_packets : 1;
+    m_queue_max_bytes   = max_bytes;
+    if (m_buffer.size() < max_bytes)
+    {
+        m_buffer.resize(max_bytes);
+    }
+    m_queue.reserve(m_queue_max_packets);
+}
+
+void OSCClient::disable_queue()
+{
+    flush();
+    m_queue_max_packets = 0;
+}
+
+void OSCClient::enable_coalescing(size_t mtu, std::chrono::microseconds max_delay)
+{
+    // Room for the bundle header and one minimal element
+    if (mtu < BUNDLE_ID.size() + sizeof(OSCTimeTag) + 4 + 8)
+    {
+        throw std::invalid_argument("Coalescing MTU is too small for a bundle");
+    }
+    send_coalesced();
+    m_coalesce.resize(mtu);
+    m_coalesce_mtu   = mtu;
+    m_coalesce_delay = max_delay;
+}
+
+void OSCClient::disable_coalescing()
+{
+    send_coalesced();
+    m_coalesce_mtu = 0;
+}
+
+bool OSCClient::flush_if_due()
+{
+    if (std::chrono::steady_clock::now() < coalesce_deadline()) return true;
+    return send_coalesced();
+}
+
+bool OSCClient::send_coalesced()
+{
+    if (m_coalesce_count == 0) return true;
+    const uint8_t* data = m_coalesce.data();
+    size_t size         = m_coalesce_size;
+    if (m_coalesce_count == 1)
+    {
+        // A lone packet needs no bundle around it
+        data += BUNDLE_ID.size() + sizeof(OSCTimeTag) + 4;
+        size -= BUNDLE_ID.size() + sizeof(OSCTimeTag) + 4;
+    }
+    m_coalesce_count = 0;
+    m_coalesce_size  = 0;
+    if (m_queue_max_packets == 0) return m_transport->send(data, size);
+    return send_uncoalesced(
+        [&](uint8_t* dst, size_t cap) -> size_t
+        {
+            if (size > cap) return 0;
+            std::memcpy(dst, data, size);
+            return size;
+        },
+        [&] { return size; }
+    );
+}
+
+bool OSCClient::flush()
+{
+    bool coalesced = send_coalesced();
+    if (m_queue.empty()) return coalesced;
+    size_t sent = m_transport->send_batch(m_queue.data(), m_queue.size());
+    bool ok     = sent == m_queue.size() && coalesced;
+    m_queue.clear();
+    m_queue_bytes = 0;
+    return ok;
+}
+
+void AddressSpace::add_method(const std::string& address, Handler handler)
+{
+    if (address.empty() || address[0] != '/' || detail::is_osc_pattern(address))
+    {
+        throw std::invalid_argument("OSC method address must be a literal path starting with '/'");
+    }
+    Node* node = m_root.get();
+    size_t pos = 1;
+    for (;;)
+    {
+        size_t slash        = address.find('/', pos);
+        std::string segment = address.substr(pos, slash == std::string::npos ? std::string::npos : slash - pos);
+        auto& child         = node->children[segment];
+        if (!child) child = std::make_unique<Node>();
+        node = child.get();
+        if (slash == std::string::npos) break;
+        pos = slash + 1;
+    }
+    node->handler = std::move(handler);
+    m_cache.clear();
+}
+
+bool AddressSpace::remove_method(const std::string& address)
+{
+    if (address.empty() || address[0] != '/') return false;
+    Node* node = m_root.get();
+    size_t pos = 1;
+    while (node != nullptr && pos <= address.size())
+    {
+        size_t slash        = address.find('/', pos);
+        std::string segment = address.substr(pos, slash == std::string::npos ? std::string::npos : slash - pos);
+        auto it             = node->children.find(segment);
+        node                = it == node->children.end() ? nullptr : it->second.get();
+        if (slash == std::string::npos) break;
+        pos = slash + 1;
+    }
+    if (node == nullptr || !node->handler) return false;
+    node->handler = nullptr;
+    m_cache.clear();
+    return true;
+}
+
+void AddressSpace::clear()
+{
+    m_root->children.clear();
+    m_root->handler = nullptr;
+    m_cache.clear();
+}
+
+size_t AddressSpace::dispatch(const MessageView& msg)
+{
+    const auto& methods = resolve(msg.address);
+    for (const Node* node : methods)
+    {
+        node->handler(msg);
+    }
+    return methods.size();
+}
+
+size_t AddressSpace::dispatch(const BundleView& bundle)
+{
+    return dispatch(bundle, 0);
+}
+
+size_t AddressSpace::dispatch(const BundleView& bundle, int depth)
+{
+    // Lazily decoded bundles reach here unchecked below the top level, so depth is bounded here too
+    if (depth >= BUNDLE_MAX_DEPTH) return 0;
+    size_t count = 0;
+    for (const auto& element : bundle)
+    {
+        if (element.is_bundle())
+        {
+            BundleView nested;
+            if (element.try_bundle(nested) == PacketError::None) count += dispatch(nested, depth + 1);
+            continue;
+        }
+        const auto& methods = resolve(element.address());
+        MessageView msg;
+        if (methods.empty() || element.try_message(msg) != PacketError::None) continue;
+        for (const Node* node : methods)
+        {
+            node->handler(msg);
+        }
+        count += methods.size();
+    }
+    return count;
+}
+
+const std::vector<const AddressSpace::Node*>& AddressSpace::resolve(std::string_view address)
+{
+    auto it = m_cache.find(address);
+    if (it != m_cache.end()) return it->second->methods;
+
+    // Bound the cache so a peer cycling through random addresses cannot grow it forever
+    if (m_cache.size() >= CACHE_MAX_SIZE) m_cache.clear();
+
+    auto entry     = std::make_unique<CacheEntry>();
+    entry->address = std::string {address};
+    if (!address.empty() && address[0] == '/') collect(*m_root, address, entry->methods);
+    std::string_view key = entry->address;
+    return m_cache.emplace(key, std::move(entry)).first->second->methods;
+}
+
+void AddressSpace::collect(const Node& node, std::string_view address, std::vector<const Node*>& out) const
+{
+    if (address.empty())
+    {
+        if (node.handler) out.push_back(&node);
+        return;
+    }
+
+    // `address` starts at the '/' in front of the next segment
+    size_t slash             = address.find('/', 1);
+    std::string_view segment = address.substr(1, slash == std::string_view::npos ? std::string_view::npos : slash - 1);
+    std::string_view rest    = slash == std::string_view::npos ? std::string_view {} : address.substr(slash);
+
+    if (!detail::is_osc_pattern(segment))
+    {
+        auto it = node.children.find(std::string {segment});
+        if (it != node.children.end()) collect(*it->second, rest, out);
+        return;
+    }
+    for (const auto& [name, child] : node.children)
+    {
+        if (detail::match_osc_pattern(segment, name)) collect(*child, rest, out);
+    }
+}
+
+ValueCoalescer::ValueCoalescer(const ValueCoalescerOptions& options) : m_options(options)
+{
+    // At most half full, which keeps linear probe runs short
+    size_t table = 16;
+    while (table < options.capacity * 2) table *= 2;
+    m_slots.resize(table);
+    m_dirty.reserve(options.capacity);
+}
+
+void ValueCoalescer::add_rule(const std::string& pattern, bool coalesce)
+{
+    if (pattern.empty() || pattern[0] != '/') throw std::invalid_argument("Coalescing rule must start with '/'");
+    m_rules.emplace_back(pattern, coalesce);
+}
+
+bool ValueCoalescer::should_coalesce(std::string_view address) const
+{
+    for (const auto& rule : m_rules)
+    {
+        if (detail::match_osc_address(rule.first, address)) return rule.second;
+    }
+    return m_options.coalesce_by_default;
+}
+
+bool ValueCoalescer::offer(const uint8_t* data, size_t size, const PacketInfo& info)
+{
+    if (size >= BUNDLE_ID.size() && detail::is_bundle(data)) return false;
+    MessageView view;
+    if (MessageView::try_decode(data, size, view) != PacketError::None) return false;
+
+    m_key.assign(view.address);
+    uint32_t hash = detail::hash_osc_address(view.address);
+    if (m_options.key_by_tags)
+    {
+        m_key.push_back('\0');
+        m_key.append(view.tags);
+        hash = detail::hash_osc_address(view.tags) ^ (hash * 16777619u);
+    }
+
+    size_t mask  = m_slots.size() - 1;
+    size_t index = hash & mask;
+    while (m_slots[index].used)
+    {
+        Slot& slot = m_slots[index];
+        if (slot.hash == hash && slot.key == m_key)
+        {
+            slot.data.assign(data, data + size);
+            slot.info = info;
+            ++m_merged;
+            return true;
+        }
+        index = (index + 1) & mask;
+    }
+
+    // Only new keys pay for the rule lookup
+    if (m_dirty.size() >= m_options.capacity || !should_coalesce(view.address)) return false;
+    Slot& slot = m_slots[index];
+    slot.used  = true;
+    slot.hash  = hash;
+    slot.key.assign(m_key);
+    slot.data.assign(data, data + size);
+    slot.info = info;
+    m_dirty.push_back(static_cast<uint32_t>(index));
+    return true;
+}
+
+bool OSCServer::process_packet(const uint8_t* data, size_t size, const PacketInfo& info)
+{
+    m_packet_info = info;
+    if (m_capture)
+    {
+        // A failing tap must not take the receive path down, so it is detached and the packet dispatched anyway
+        try
+        {
+            m_capture->write(data, size, info);
+        }
+        catch (const std::system_error&)
+        {
+            m_capture = nullptr;
+            report(PacketError::CaptureFailed, data, size);
+        }
+    }
+    if (m_packet_filter && !m_packet_filter(data, size)) return true;
+    if (info.rx_time_ns != 0)
+    {
+        m_stats.record_receive_to_dispatch(info.rx_time_ns);
+        if (m_timing_max_sources > 0) track_timing(data, size, info);
+    }
+    PacketError error = dispatch(data, size);
+    if (error == PacketError::None) return true;
+    report(error, data, size);
+    return false;
+}
+
+void OSCServer::report(PacketError error, const uint8_t* data, size_t size)
+{
+    m_stats.count_error(error);
+    auto now = std::chrono::steady_clock::now();
+    if (now - m_error_window >= std::chrono::seconds(1))
+    {
+        m_error_window     = now;
+        m_errors_in_window = 0;
+    }
+    if (m_errors_in_window >= m_error_limit)
+    {
+        m_errors_suppressed++;
+        return;
+    }
+    m_errors_in_window++;
+    if (m_error_handler)
+    {
+        m_error_handler(error, data, size);
+    }
+    else
+    {
+        std::cerr << "Error processing OSC packet: " << to_string(error) << "\n";
+    }
+}
+
+void OSCServer::track_timing(const uint8_t* data, size_t size, const PacketInfo& info)
+{
+    if (size < 16 || !detail::is_bundle(data)) return;
+    OSCTimeTag timetag = detail::read_u64_be(data + 8);
+    if (timetag == TIMETAG_IMMEDIATE) return;
+
+    uint64_t key = (uint64_t(info.source_address) << 16) | info.source_port;
+    auto it      = m_timing.find(key);
+    if (it == m_timing.end())
+    {
+        if (m_timing.size() >= m_timing_max_sources) return;
+        it                 = m_timing.emplace(key, SourceTiming {}).first;
+        it->second.address = info.source_address;
+        it->second.port    = info.source_port;
+    }
+    SourceTiming& timing = it->second;
+    auto sent            = std::chrono::duration_cast<std::chrono::nanoseconds>(from_timetag(timetag).time_since_epoch());
+    int64_t offset       = info.rx_time_ns - sent.count();
+    if (timing.samples == 0 || offset < timing.min_offset_ns) timing.min_offset_ns = offset;
+    if (timing.samples == 0 || offset > timing.max_offset_ns) timing.max_offset_ns = offset;
+    timing.samples++;
+    timing.last_offset_ns  = offset;
+    timing.mean_offset_ns += (static_cast<double>(offset) - timing.mean_offset_ns) / static_cast<double>(timing.samples);
+}
+
+std::vector<SourceTiming> OSCServer::source_timing() const
+{
+    std::vector<SourceTiming> out;
+    out.reserve(m_timing.size());
+    for (const auto& entry : m_timing) out.push_back(entry.second);
+    return out;
+}
+
+bool OSCServer::process_one()
+{
+    bool fired = run_scheduled() > 0;
+    bool ok    = true;
+    if (m_ring)
+    {
+        auto process = [&](const uint8_t* data, size_t size, const PacketInfo& info)
+        {
+            ok = process_packet(data, size, info);
+        };
+        if (!m_ring->pop(process)) ok = fired;
+    }
+    else if (m_transport->has_receive_views())
+    {
+        Packet view;
+        PacketInfo info;
+        if (m_transport->receive_views(&view, &info, 1) == 0) ok = fired;
+        else ok = process_packet(view.data, view.size, info);
+    }
+    else if (m_transport->receive_batch(m_batch.data(), 1) == 0)
+    {
+        ok = fired;
+    }
+    else
+    {
+        ok = process_packet(m_batch[0].data, m_batch[0].size, m_batch[0].info);
+    }
+    flush_coalesced();
+    return ok;
+}
+
+PacketError OSCServer::dispatch(const uint8_t* data, size_t size)
+{
+    using namespace detail;
+    if (m_coalescer && m_coalescer->offer(data, size, m_packet_info)) return PacketError::None;
+    if (m_scheduler && size >= BUNDLE_ID.size() && is_bundle(data))
+    {
+        // Validates the bundle up front so junk is reported on arrival rather than when due
+        BundleView view;
+        PacketError error = m_lazy_bundles ? BundleView::try_decode_lazy(data, size, view)
+                                           : BundleView::try_decode(data, size, view);
+        if (error != PacketError::None) return error;
+        if (view.timetag != TIMETAG_IMMEDIATE && view.timetag > timetag_now() &&
+            m_scheduler->schedule(view.timetag, data, size))
+        {
+            return PacketError::None;
+        }
+    }
+    return dispatch_now(data, size);
+}
+
+PacketError OSCServer::dispatch_now(const uint8_t* data, size_t size)
+{
+    using namespace detail;
+    PacketError error = PacketError::None;
+    // Everything is decoded before the first handler runs, and the handlers are timed together so
+    // a packet is one handler_ns sample however many kinds of handler it reaches
+    if (size >= BUNDLE_ID.size() && is_bundle(data))
+    {
+        BundleView view;
+        bool views = m_bundle_view_handler || m_address_space;
+        if (views)
+        {
+            error = m_lazy_bundles ? BundleView::try_decode_lazy(data, size, view)
+                                   : BundleView::try_decode(data, size, view);
+            if (error != PacketError::None) return error;
+        }
+        if (m_bundle_handler)
+        {
+            error = Bundle::try_decode_into(m_bundle, data, size);
+            if (error != PacketError::None) return error;
+        }
+        if (views || m_bundle_handler)
+        {
+            auto start = Stats::start_timer();
+            try
+            {
+                if (m_bundle_view_handler) m_bundle_view_handler(view);
+                if (m_address_space) m_address_space->dispatch(view);
+                if (m_bundle_handler) m_bundle_handler(m_bundle);
+            }
+            catch (const std::exception&)
+            {
+                return PacketError::HandlerException;
+            }
+            m_stats.record_handler_time(start);
+        }
+        m_stats.count_dispatched(true);
+        return PacketError::None;
+    }
+    MessageView view;
+    bool views = m_msg_view_handler || m_address_space;
+    if (views)
+    {
+        error = MessageView::try_decode(data, size, view);
+        if (error != PacketError::None) return error;
+    }
+    if (m_msg_handler)
+    {
+        error = Message::try_decode_into(m_message, data, size);
+        if (error != PacketError::None) return error;
+    }
+    if (views || m_msg_handler)
+    {
+        auto start = Stats::start_timer();
+        try
+        {
+            if (m_msg_view_handler) m_msg_view_handler(view);
+            if (m_address_space) m_address_space->dispatch(view);
+            if (m_msg_handler) m_msg_handler(m_message);
+        }
+        catch (const std::exception&)
+        {
+            return PacketError::HandlerException;
+        }
+        m_stats.record_handler_time(start);
+    }
+    m_stats.count_dispatched(false);
+    return PacketError::None;
+}
+
+int OSCServer::run_scheduled()
+{
+    if (!m_scheduler || m_scheduler->empty()) return 0;
+    auto run = [this](const uint8_t* data, size_t size)
+    {
+        m_packet_info     = PacketInfo {};
+        PacketError error = dispatch_now(data, size);
+        if (error != PacketError::None) report(error, data, size);
+    };
+    return static_cast<int>(m_scheduler->run_due(timetag_now(), run));
+}
+
+void OSCServer::flush_coalesced()
+{
+    if (!m_coalescer || m_coalescer->pending() == 0) return;
+    auto run = [this](const uint8_t* data, size_t size, const PacketInfo& info)
+    {
+        m_packet_info     = info;
+        PacketError error = dispatch_now(data, size);
+        if (error != PacketError::None) report(error, data, size);
+    };
+    m_coalescer->drain(run);
+}
+
+int OSCServer::process_all()
+{
+    int count = run_scheduled();
+    if (m_ring)
+    {
+        auto process = [&](const uint8_t* data, size_t size, const PacketInfo& info)
+        {
+            if (process_packet(data, size, info)) count++;
+        };
+        while (m_ring->pop(process))
+        {
+        }
+        flush_coalesced();
+        return count;
+    }
+    if (m_transport->has_receive_views())
+    {
+        // Views may come back short while more is buffered, so only an empty call means drained
+        Packet views[RECEIVE_BATCH_SIZE];
+        PacketInfo infos[RECEIVE_BATCH_SIZE];
+        while (size_t received = m_transport->receive_views(views, infos, RECEIVE_BATCH_SIZE))
+        {
+            for (size_t i = 0; i < received; ++i)
+            {
+                if (process_packet(views[i].data, views[i].size, infos[i])) count++;
+            }
+        }
+        flush_coalesced();
+        return count;
+    }
+    for (;;)
+    {
+        size_t received = m_transport->receive_batch(m_batch.data(), m_batch.size());
+        for (size_t i = 0; i < received; ++i)
+        {
+            if (process_packet(m_batch[i].data, m_batch[i].size, m_batch[i].info)) count++;
+        }
+        // A partial batch means the socket is drained, skip the extra call that would only see EAGAIN
+        if (received < m_batch.size()) break;
+    }
+    flush_coalesced();
+    return count;
+}
+
+void OSCServer::start_receive_thread(size_t capacity, OverflowPolicy policy, size_t max_packet_size)
+{
+    if (m_ring) return;
+    if (!open_wake_pipe(m_wake_fds) || !open_wake_pipe(m_stop_fds))
+    {
+        close_wake_pipe(m_wake_fds);
+        throw std::system_error(errno, std::generic_category(), "Receive thread pipe setup failed");
+    }
+    m_ring = std::make_unique<PacketRing>(capacity, max_packet_size, policy);
+    m_receiving.store(true, std::memory_order_release);
+    m_receiver = std::thread(&OSCServer::receive_loop, this);
+}
+
+void OSCServer::stop_receive_thread()
+{
+    if (!m_ring) return;
+    m_receiving.store(false, std::memory_order_release);
+    signal_wake_pipe(m_stop_fds[1]);
+    if (m_receiver.joinable()) m_receiver.join();
+    close_wake_pipe(m_stop_fds);
+    close_wake_pipe(m_wake_fds);
+    m_ring.reset();
+}
+
+void OSCServer::receive_loop()
+{
+    int fd = m_transport->native_handle();
+    bool own_wait = m_transport->has_wait();
+    while (m_receiving.load(std::memory_order_acquire))
+    {
+        if (own_wait)
+        {
+            // The stop pipe can't interrupt the transport's wait, so wake up now and then to check
+            m_transport->wait_readable(std::chrono::milliseconds(10));
+        }
+        else
+        {
+            struct pollfd fds[2];
+            fds[0].fd      = fd;
+            fds[0].events  = POLLIN;
+            fds[0].revents = 0;
+            fds[1].fd      = m_stop_fds[0];
+            fds[1].events  = POLLIN;
+            fds[1].revents = 0;
+            // Without a descriptor to sleep on, fall back to polling the transport every POLL_INTERVAL_MS
+            auto timeout = std::chrono::milliseconds(fd >= 0 ? -1 : POLL_INTERVAL_MS);
+            poll_for(fd >= 0 ? fds : fds + 1, fd >= 0 ? 2 : 1, timeout);
+        }
+
+        bool pushed = false;
+        size_t received = 0;
+        if (m_transport->has_receive_views())
+        {
+            // Frames over the ring's slot size are dropped by push()
+            Packet views[RECEIVE_BATCH_SIZE];
+            PacketInfo infos[RECEIVE_BATCH_SIZE];
+            while ((received = m_transport->receive_views(views, infos, RECEIVE_BATCH_SIZE)) > 0)
+            {
+                for (size_t i = 0; i < received; ++i) pushed |= m_ring->push(views[i].data, views[i].size, infos[i]);
+            }
+        }
+        else
+        {
+            do
+            {
+                received = m_transport->receive_batch(m_batch.data(), m_batch.size());
+                for (size_t i = 0; i < received; ++i)
+                {
+                    pushed |= m_ring->push(m_batch[i].data, m_batch[i].size, m_batch[i].info);
+                }
+            } while (received == m_batch.size());
+        }
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (pushed && m_consumer_waiting.load(std::memory_order_seq_cst))
+        {
+            signal_wake_pipe(m_wake_fds[1]);
+        }
+    }
+}
+
+std::chrono::nanoseconds OSCServer::next_timeout(std::chrono::nanoseconds timeout) const
+{
+    if (m_scheduler && !m_scheduler->empty())
+    {
+        auto until_due = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            from_timetag(m_scheduler->next_due()) - std::chrono::system_clock::now()
+        );
+        if (until_due < std::chrono::nanoseconds::zero()) until_due = std::chrono::nanoseconds::zero();
+        if (timeout < std::chrono::nanoseconds::zero() || until_due < timeout) timeout = until_due;
+    }
+    return timeout;
+}
+
+int OSCServer::wait_and_process(std::chrono::nanoseconds timeout)
+{
+    timeout = next_timeout(timeout);
+
+    if (m_ring)
+    {
+        int count = process_all();
+        if (count > 0) return count;
+        // Announce the sleep before re-checking, so a packet pushed in between is guaranteed to signal us
+        m_consumer_waiting.store(true, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_ring->depth() == 0)
+        {
+            struct pollfd pfd;
+            pfd.fd      = m_wake_fds[0];
+            pfd.events  = POLLIN;
+            pfd.revents = 0;
+            poll_for(&pfd, 1, timeout);
+        }
+        m_consumer_waiting.store(false, std::memory_order_relaxed);
+        drain_wake_pipe(m_wake_fds[0]);
+        return process_all();
+    }
+
+    if (m_transport->has_wait())
+    {
+        int count = process_all();
+        if (count > 0) return count;
+        m_transport->wait_readable(timeout);
+        return process_all();
+    }
+
+    int fd = m_transport->native_handle();
+    if (fd < 0)
+    {
+        // Nothing to sleep on, so poll the transport. An indefinite wait gives up after one interval
+        // rather than never returning, and a caller looping on it polls without spinning.
+        auto interval = std::chrono::milliseconds(POLL_INTERVAL_MS);
+        auto deadline = std::chrono::steady_clock::now() + (timeout < std::chrono::nanoseconds::zero()
+                                                                 ? std::chrono::nanoseconds(interval)
+                                                                 : timeout);
+        for (;;)
+        {
+            int count = process_all();
+            if (count > 0) return count;
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline) return 0;
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(deadline - now, interval));
+        }
+    }
+
+    struct pollfd pfd;
+    pfd.fd      = fd;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+    poll_for(&pfd, 1, timeout);
+    return process_all();
+}
+
+ShardedOSCServer::ShardedOSCServer(uint16_t port, size_t shard_count, bool address_affinity)
+{
+    if (shard_count == 0) shard_count = std::max(1u, std::thread::hardware_concurrency());
+
+    UDPTransportOptions options;
+    options.reuse_port = true;
+    for (size_t i = 0; i < shard_count; ++i)
+    {
+        auto shard       = std::make_unique<Shard>();
+        auto transport   = std::make_unique<UDPTransport>(port, options);
+        shard->socket_fd = transport->native_handle();
+        shard->server    = std::make_unique<OSCServer>(std::move(transport));
+        if (!open_wake_pipe(shard->wake_fds))
+        {
+            throw std::system_error(errno, std::generic_category(), "Shard wakeup pipe setup failed");
+        }
+        shard->inbox.entries.resize(RECEIVE_QUEUE_CAPACITY);
+        m_shards.push_back(std::move(shard));
+    }
+
+    if (address_affinity && shard_count > 1)
+    {
+        for (size_t i = 0; i < shard_count; ++i)
+        {
+            m_shards[i]->server->set_packet_filter(
+                [this, i](const uint8_t* data, size_t size)
+                {
+                    size_t owner = owner_of(data, size);
+                    if (owner == i) return true;
+                    forward(owner, data, size, m_shards[i]->server->packet_info());
+                    return false;
+                }
+            );
+        }
+    }
+}
+
+ShardedOSCServer::Shard::~Shard()
+{
+    close_wake_pipe(wake_fds);
+}
+
+size_t ShardedOSCServer::owner_of(const uint8_t* data, size_t size) const
+{
+    using namespace detail;
+    // Bundles go by the address of their first element
+    while (size >= 20 && is_bundle(data))
+    {
+        size_t len = read_u32_be(data + 16);
+        if (len > size - 20) break;
+        data += 20;
+        size  = len;
+    }
+    size_t len = find_nul(data, size);
+    return hash_osc_address({reinterpret_cast<const char*>(data), len}) % m_shards.size();
+}
+
+void ShardedOSCServer::forward(size_t index, const uint8_t* data, size_t size, const PacketInfo& info)
+{
+    Shard& shard = *m_shards[index];
+    {
+        std::lock_guard<std::mutex> lock(shard.inbox_mutex);
+        Inbox& inbox = shard.inbox;
+        if (inbox.size == inbox.entries.size())
+        {
+            shard.inbox_drops++;
+            return;
+        }
+        Forwarded& entry = inbox.entries[inbox.size++];
+        entry.bytes.assign(data, data + size);
+        entry.info = info;
+    }
+    signal_wake_pipe(shard.wake_fds[1]);
+}
+
+uint64_t ShardedOSCServer::forward_drops() const
+{
+    uint64_t total = 0;
+    for (const auto& shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->inbox_mutex);
+        total += shard->inbox_drops;
+    }
+    return total;
+}
+
+void ShardedOSCServer::start(bool pin_threads)
+{
+    if (m_running.exchange(true)) return;
+    for (size_t i = 0; i < m_shards.size(); ++i)
+    {
+        m_shards[i]->worker = std::thread(&ShardedOSCServer::run, this, i);
+#if defined(__linux__)
+        if (pin_threads)
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+            pthread_setaffinity_np(m_shards[i]->worker.native_handle(), sizeof(cpus), &cpus);
+        }
+#else
+        (void)pin_threads;
+#endif
+    }
+}
+
+void ShardedOSCServer::stop()
+{
+    if (m_running.exchange(false))
+    {
+        for (auto& shard : m_shards)
+        {
+            signal_wake_pipe(shard->wake_fds[1]);
+        }
+        for (auto& shard : m_shards)
+        {
+            if (shard->worker.joinable()) shard->worker.join();
+        }
+    }
+}
+
+StatsSnapshot ShardedOSCServer::stats() const
+{
+    StatsSnapshot total;
+    for (const auto& shard : m_shards) total += shard->server->stats().snapshot();
+    return total;
+}
+
+void ShardedOSCServer::run(size_t index)
+{
+    Shard& shard = *m_shards[index];
+    Inbox pending;
+    pending.entries.resize(shard.inbox.entries.size());
+    while (m_running.load(std::memory_order_acquire))
+    {
+        struct pollfd fds[2];
+        fds[0].fd      = shard.socket_fd;
+        fds[0].events  = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd      = shard.wake_fds[0];
+        fds[1].events  = POLLIN;
+        fds[1].revents = 0;
+        poll_for(fds, 2, shard.server->next_timeout());
+
+        if (fds[1].revents & POLLIN) drain_wake_pipe(shard.wake_fds[0]);
+        {
+            std::lock_guard<std::mutex> lock(shard.inbox_mutex);
+            std::swap(pending, shard.inbox);
+        }
+        for (size_t i = 0; i < pending.size; ++i)
+        {
+            const Forwarded& packet = pending.entries[i];
+            shard.server->process_packet(packet.bytes.data(), packet.bytes.size(), packet.info);
+        }
+        pending.size = 0;
+        shard.server->process_all();
+    }
+}
+
+
+#if defined(__linux__)
+namespace {
+
+// Registers a private duplicate of `fd`, so that removing the registration can never touch one
+// made for the same descriptor elsewhere. Returns the duplicate, or -1.
+int add_epoll_registration(int epoll_fd, int fd, uint32_t events, uint64_t key)
+{
+    int own = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (own < 0) return -1;
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events   = events;
+    event.data.u64 = key;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, own, &event) < 0)
+    {
+        ::close(own);
+        return -1;
+    }
+    return own;
+}
+
+void remove_epoll_registration(int epoll_fd, int own)
+{
+    // The file may still be open through the caller's descriptor, which would keep it registered
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, own, nullptr);
+    ::close(own);
+}
+
+}  // namespace
+
+// Watches and servers stay registered between iterations. Watch keys are their id shifted left,
+// server keys the server's address with the low bit set.
+struct EventLoop::PollSet
+{
+    struct ServerRegistration
+    {
+        // The descriptor it was registered for, to notice the server's changing
+        int fd {-1};
+        int own {-1};
+    };
+
+    PollSet() : epoll_fd(epoll_create1(EPOLL_CLOEXEC))
+    {
+        if (epoll_fd < 0) throw std::system_error(errno, std::generic_category(), "EventLoop setup failed");
+    }
+    PollSet(const PollSet&)            = delete;
+    PollSet& operator=(const PollSet&) = delete;
+    ~PollSet()
+    {
+        for (const auto& server : servers)
+        {
+            if (server.own >= 0) ::close(server.own);
+        }
+        for (const auto& watch : watches) ::close(watch.second);
+        ::close(epoll_fd);
+    }
+
+    void add_watch(const Watch& watch)
+    {
+        int own = add_epoll_registration(epoll_fd, watch.fd, watch.writable ? EPOLLOUT : EPOLLIN, watch.id << 1);
+        if (own < 0) throw std::system_error(errno, std::generic_category(), "EventLoop::watch failed");
+        watches.emplace(watch.id, own);
+    }
+    void remove_watch(uint64_t id)
+    {
+        auto it = watches.find(id);
+        if (it == watches.end()) return;
+        remove_epoll_registration(epoll_fd, it->second);
+        watches.erase(it);
+    }
+
+    void add_server()
+    {
+        servers.emplace_back();
+    }
+    void remove_server(size_t index)
+    {
+        if (servers[index].own >= 0) remove_epoll_registration(epoll_fd, servers[index].own);
+        servers[index] = ServerRegistration {};
+    }
+    void move_server(size_t from, size_t to)
+    {
+        servers[to] = servers[from];
+    }
+    void keep_servers(size_t count)
+    {
+        servers.resize(count);
+    }
+    // Follows the server's descriptor (it goes away while a receive thread runs); false if the server
+    // can't be waited on and has to be polled
+    bool track_server(size_t index, OSCServer* server, int fd)
+    {
+        ServerRegistration& registration = servers[index];
+        if (fd != registration.fd)
+        {
+            if (registration.own >= 0) remove_epoll_registration(epoll_fd, registration.own);
+            registration.fd  = fd;
+            registration.own = fd >= 0 ? add_epoll_registration(
+                                             epoll_fd, fd, EPOLLIN, reinterpret_cast<uintptr_t>(server) | 1
+                                         )
+                                       : -1;
+        }
+        return registration.own >= 0;
+    }
+
+    size_t wait(EventLoop& loop, std::chrono::nanoseconds timeout)
+    {
+        size_t registered = watches.size();
+        for (const auto& server : servers) registered += server.own >= 0;
+        if (registered == 0 && timeout < std::chrono::nanoseconds::zero()) timeout = std::chrono::nanoseconds::zero();
+
+        // Sleeping in ppoll() on the epoll descriptor keeps nanosecond timeouts; epoll_wait() only collects
+        struct pollfd pfd;
+        pfd.fd      = epoll_fd;
+        pfd.events  = POLLIN;
+        pfd.revents = 0;
+        if (poll_for(&pfd, 1, timeout) < 0 && errno != EINTR)
+        {
+            throw std::system_error(errno, std::generic_category(), "EventLoop poll failed");
+        }
+        int ready = 0;
+        if (pfd.revents != 0 && registered > 0)
+        {
+            if (events.size() < registered) events.resize(registered);
+            ready = epoll_wait(epoll_fd, events.data(), static_cast<int>(events.size()), 0);
+            if (ready < 0 && errno != EINTR)
+            {
+                throw std::system_error(errno, std::generic_category(), "EventLoop poll failed");
+            }
+            ready = std::max(ready, 0);
+        }
+
+        ready_servers.clear();
+        for (int i = 0; i < ready; ++i)
+        {
+            uint64_t key = events[i].data.u64;
+            if (key & 1) ready_servers.push_back(reinterpret_cast<OSCServer*>(static_cast<uintptr_t>(key - 1)));
+        }
+        size_t handled = 0;
+        for (size_t i = 0; i < loop.m_servers.size(); ++i)
+        {
+            OSCServer* server = loop.m_servers[i];
+            if (!server) continue;
+            bool readable = servers[i].own < 0 ||
+                            std::find(ready_servers.begin(), ready_servers.end(), server) != ready_servers.end();
+            if (readable || server->pending_bundles() > 0) handled += static_cast<size_t>(server->process_all());
+        }
+        for (int i = 0; i < ready; ++i)
+        {
+            uint64_t key = events[i].data.u64;
+            if (key & 1) continue;
+            auto it = loop.m_watches.find(key >> 1);
+            if (it == loop.m_watches.end() || it->second->removed) continue;
+            it->second->fn();
+            ++handled;
+        }
+        return handled;
+    }
+
+    int epoll_fd;
+    std::vector<struct epoll_event> events;
+    // Per server in m_servers
+    std::vector<ServerRegistration> servers;
+    // Watch id to its registered duplicate
+    std::unordered_map<uint64_t, int> watches;
+    std::vector<OSCServer*> ready_servers;
+};
+#else
+// Without epoll the pollfd set is rebuilt from the servers and watches on every iteration
+struct EventLoop::PollSet
+{
+    void add_watch(const Watch&)
+    {}
+    void remove_watch(uint64_t)
+    {}
+    void add_server()
+    {}
+    void remove_server(size_t)
+    {}
+    void move_server(size_t, size_t)
+    {}
+    void keep_servers(size_t)
+    {}
+    bool track_server(size_t, OSCServer*, int fd)
+    {
+        return fd >= 0;
+    }
+
+    size_t wait(EventLoop& loop, std::chrono::nanoseconds timeout)
+    {
+        fds.clear();
+        server_slots.clear();
+        watch_of.clear();
+        for (OSCServer* server : loop.m_servers)
+        {
+            int fd = server->native_handle();
+            server_slots.push_back(fd >= 0 ? static_cast<int>(fds.size()) : -1);
+            if (fd >= 0) fds.push_back({fd, POLLIN, 0});
+        }
+        for (const auto& entry : loop.m_watches)
+        {
+            const Watch& watch = *entry.second;
+            fds.push_back({watch.fd, static_cast<short>(watch.writable ? POLLOUT : POLLIN), 0});
+            watch_of.push_back(entry.second.get());
+        }
+
+        if (!fds.empty())
+        {
+            if (poll_for(fds.data(), fds.size(), timeout) < 0 && errno != EINTR)
+            {
+                throw std::system_error(errno, std::generic_category(), "EventLoop poll failed");
+            }
+        }
+        else if (timeout > std::chrono::nanoseconds::zero())
+        {
+            std::this_thread::sleep_for(timeout);
+        }
+
+        size_t handled = 0;
+        for (size_t i = 0; i < server_slots.size(); ++i)
+        {
+            OSCServer* server = loop.m_servers[i];
+            int slot          = server_slots[i];
+            if (!server) continue;
+            if (slot < 0 || fds[slot].revents != 0 || server->pending_bundles() > 0)
+            {
+                handled += static_cast<size_t>(server->process_all());
+            }
+        }
+        size_t first_watch = fds.size() - watch_of.size();
+        for (size_t i = 0; i < watch_of.size(); ++i)
+        {
+            // Unwatched ones stay allocated until the next iteration
+            Watch& watch = *watch_of[i];
+            if (fds[first_watch + i].revents == 0 || watch.removed) continue;
+            watch.fn();
+            ++handled;
+        }
+        return handled;
+    }
+
+    std::vector<struct pollfd> fds;
+    // Per server, its entry in fds or -1
+    std::vector<int> server_slots;
+    // Per entry of fds past the servers', its watch
+    std::vector<Watch*> watch_of;
+};
+#endif
+
+EventLoop::EventLoop() : m_poll(std::make_unique<PollSet>())
+{}
+
+EventLoop::~EventLoop() = default;
+
+void EventLoop::add_server(OSCServer& server)
+{
+    if (std::find(m_servers.begin(), m_servers.end(), &server) != m_servers.end()) return;
+    m_servers.push_back(&server);
+    m_poll->add_server();
+}
+
+void EventLoop::remove_server(OSCServer& server)
+{
+    // Only cleared here, the slot goes once no iteration can be walking the list
+    auto it = std::find(m_servers.begin(), m_servers.end(), &server);
+    if (it == m_servers.end()) return;
+    *it = nullptr;
+    m_poll->remove_server(static_cast<size_t>(it - m_servers.begin()));
+}
+
+uint64_t EventLoop::watch(int fd, Callback on_ready, bool writable)
+{
+    if (fd < 0) throw std::invalid_argument("EventLoop::watch needs a descriptor");
+    uint64_t id = m_next_id++;
+    auto watch  = std::make_unique<Watch>(Watch {id, fd, writable, false, std::move(on_ready)});
+    m_poll->add_watch(*watch);
+    m_watches.emplace(id, std::move(watch));
+    return id;
+}
+
+void EventLoop::unwatch(uint64_t id)
+{
+    auto it = m_watches.find(id);
+    if (it == m_watches.end()) return;
+    // Its callback may be the one running, so it is only freed on the next iteration
+    it->second->removed = true;
+    m_poll->remove_watch(id);
+    m_retired.push_back(std::move(it->second));
+    m_watches.erase(it);
+}
+
+uint64_t EventLoop::add_timer(Clock::time_point deadline, Callback fn)
+{
+    uint64_t id = m_next_id++;
+    m_timer_callbacks.emplace(id, std::move(fn));
+    m_timers.push_back({deadline, id});
+    std::push_heap(m_timers.begin(), m_timers.end(), later);
+    return id;
+}
+
+bool EventLoop::cancel_timer(uint64_t id)
+{
+    // The heap entry stays behind and is skipped when it comes up
+    return m_timer_callbacks.erase(id) > 0;
+}
+
+void EventLoop::post(Callback fn)
+{
+    m_posted.push_back(std::move(fn));
+}
+
+size_t EventLoop::run_posted()
+{
+    // Callbacks posted meanwhile wait for the next round, so a task re-posting itself can't starve polling
+    size_t count = m_posted.size();
+    size_t run   = 0;
+    while (run < count && !m_posted.empty())
+    {
+        Callback fn = std::move(m_posted.front());
+        m_posted.pop_front();
+        ++run;
+        fn();
+    }
+    return run;
+}
+
+size_t EventLoop::run_timers()
+{
+    size_t count = 0;
+    auto now     = Clock::now();
+    while (!m_timers.empty() && m_timers.front().deadline <= now)
+    {
+        std::pop_heap(m_timers.begin(), m_timers.end(), later);
+        uint64_t id = m_timers.back().id;
+        m_timers.pop_back();
+        auto it = m_timer_callbacks.find(id);
+        if (it == m_timer_callbacks.end()) continue;
+        Callback fn = std::move(it->second);
+        m_timer_callbacks.erase(it);
+        fn();
+        ++count;
+    }
+    return count;
+}
+
+bool EventLoop::has_work() const
+{
+    for (const OSCServer* server : m_servers)
+    {
+        if (server) return true;
+    }
+    return !m_watches.empty() || !m_timer_callbacks.empty() || !m_posted.empty();
+}
+
+size_t EventLoop::run_once(std::chrono::nanoseconds timeout)
+{
+    m_retired.clear();
+    size_t kept = 0;
+    for (size_t i = 0; i < m_servers.size(); ++i)
+    {
+        if (!m_servers[i]) continue;
+        m_servers[kept] = m_servers[i];
+        m_poll->move_server(i, kept++);
+    }
+    m_servers.resize(kept);
+    m_poll->keep_servers(kept);
+
+    size_t handled = run_posted();
+    if (handled > 0 || !m_posted.empty()) timeout = std::chrono::nanoseconds::zero();
+
+    bool polled_servers = false;
+    for (size_t i = 0; i < m_servers.size(); ++i)
+    {
+        OSCServer* server  = m_servers[i];
+        polled_servers    |= !m_poll->track_server(i, server, server->native_handle());
+        timeout            = server->next_timeout(timeout);
+    }
+
+    auto interval = std::chrono::milliseconds(POLL_INTERVAL_MS);
+    if (polled_servers && (timeout < std::chrono::nanoseconds::zero() || timeout > interval)) timeout = interval;
+    while (!m_timers.empty() && m_timer_callbacks.count(m_timers.front().id) == 0)
+    {
+        std::pop_heap(m_timers.begin(), m_timers.end(), later);
+        m_timers.pop_back();
+    }
+    if (!m_timers.empty())
+    {
+        auto until_due = std::max(m_timers.front().deadline - Clock::now(), Clock::duration::zero());
+        if (timeout < std::chrono::nanoseconds::zero() || until_due < timeout)
+        {
+            timeout = std::chrono::duration_cast<std::chrono::nanoseconds>(until_due);
+        }
+    }
+
+    handled += m_poll->wait(*this, timeout);
+    handled += run_timers();
+    // Coroutines woken by the packets just processed resume without another trip through poll
+    handled += run_posted();
+    return handled;
+}
+
+void EventLoop::run()
+{
+    m_stopped = false;
+    while (!m_stopped && has_work()) run_once();
 }
 
 }  // namespace NanoOsc